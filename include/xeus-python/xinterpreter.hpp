@@ -32,6 +32,10 @@ namespace nl = nlohmann;
 
 namespace xpyt
 {
+    class xcompletion_worker;
+    class xinspect_cache;
+    class xsymbol_index;
+
     class XEUS_PYTHON_API interpreter : public xeus::xinterpreter
     {
     public:
@@ -76,12 +80,25 @@ namespace xpyt
 
         void redirect_output();
 
+        // Runs a cell of a batch received on the batch comm target
+        nl::json run_batch_cell(const std::string& code, std::size_t index);
+
         py::object m_ipython_shell_app;
         py::object m_ipython_shell;
+        py::object m_transformer_manager;
         py::object m_displayhook;
         py::object m_logger;
         py::object m_terminal_stream;
 
+        // Answers completion requests while a cell is running, must be
+        // destroyed while the GIL is held
+        std::unique_ptr<xcompletion_worker> m_completion_worker;
+        bool m_busy = false;
+
+        // Completion and inspection caches
+        std::unique_ptr<xsymbol_index> m_symbol_index;
+        std::unique_ptr<xinspect_cache> m_inspect_cache;
+
         // The interpreter has the same scope as a `gil_scoped_release` instance
         // so that the GIL is not held by default, it will only be held when the
         // interpreter wants to execute Python code. This means that whenever
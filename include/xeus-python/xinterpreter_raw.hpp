@@ -30,6 +30,10 @@ namespace nl = nlohmann;
 
 namespace xpyt
 {
+    class xcode_cache;
+    class xcompletion_engine;
+    class xcompletion_worker;
+
     class XEUS_PYTHON_API raw_interpreter : public xeus::xinterpreter
     {
     public:
@@ -72,8 +76,20 @@ namespace xpyt
 
         void redirect_output();
 
+        // Runs a cell of a batch received on the batch comm target
+        nl::json run_batch_cell(const std::string& code, std::size_t index);
+
         py::object m_displayhook;
 
+        // Compiled cells and completion state, must be destroyed while the GIL is held
+        std::unique_ptr<xcode_cache> m_code_cache;
+        std::unique_ptr<xcompletion_engine> m_completion_engine;
+        std::unique_ptr<xcompletion_worker> m_completion_worker;
+        bool m_busy = false;
+        // Execution count of the last request stored in the history, batch
+        // results are published with the next one
+        int m_execution_count = 0;
+
         // The interpreter has the same scope as a `gil_scoped_release` instance
         // so that the GIL is not held by default, it will only be held when the
         // interpreter wants to execute Python code. This means that whenever
@@ -0,0 +1,220 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_SHELL_RUNNER_HPP
+#define XPYT_SHELL_RUNNER_HPP
+
+#ifdef __GNUC__
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wattributes"
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xeus_context.hpp"
+#include "xeus/xkernel_configuration.hpp"
+#include "xeus/xmessage.hpp"
+#include "xeus/xserver.hpp"
+
+#include "xeus-zmq/xcontrol_runner.hpp"
+#include "xeus-zmq/xshell_runner.hpp"
+
+#include "xeus_python_config.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    // Shell runner able to dispatch some messages while another request,
+    // typically an execute_request, is running. By default, these are comm
+    // messages and the lightweight requests answered from kernel state:
+    // kernel_info, history, is_complete and complete requests. The
+    // interpreters only answer the latter from their caches while busy.
+    //
+    // The shell socket is owned by an I/O thread: it is the only thread
+    // reading and sending shell messages. The replies of the requests
+    // handled on other threads are queued and sent by the I/O thread,
+    // through the server returned by make_concurrent_server.
+    //
+    // The I/O thread hands the messages over to the main thread, which runs
+    // the requests. While a request is processed, it schedules a Python
+    // pending call for each new message. The pending call runs on the main
+    // thread between two bytecodes: it dispatches the concurrent messages
+    // right away and defers the other ones until the running request has
+    // completed.
+    //
+    // The kernel_info, history and is_complete requests received while a
+    // request is processed are rather handled on a responder thread, so that
+    // they are answered even when the main thread runs native code or sleeps
+    // without executing bytecodes. They only need the GIL to be released.
+    //
+    // The runner also hosts the subshells of the kernel subshell protocol
+    // (JEP 91). Each subshell has its own thread, shell messages whose header
+    // holds a subshell_id are handled on that thread, concurrently with the
+    // main shell, in the same namespace. The kernel core is shared by these
+    // threads, it is only used with the GIL held. Subshells are therefore
+    // not available in free-threaded builds.
+    class XEUS_PYTHON_API shell_runner final : public xeus::xshell_runner
+    {
+    public:
+
+        explicit shell_runner(xeus::xcontext& context,
+                              std::chrono::milliseconds poll_interval = std::chrono::milliseconds(50));
+        ~shell_runner() override;
+
+        void add_concurrent_message_type(const std::string& msg_type);
+
+        // Called from the control thread, return the id of the new subshell,
+        // whether the subshell existed, and the ids of the subshells.
+        std::string create_subshell();
+        bool delete_subshell(const std::string& subshell_id);
+        std::vector<std::string> list_subshells() const;
+
+        // Server whose shell socket is used by the I/O thread
+        void set_server(xeus::xserver& server);
+
+        // Called from any thread, the message is sent by the I/O thread
+        void send_shell(xeus::xmessage msg);
+
+        // Passes the requests queued for the shell of the calling thread,
+        // the main shell or a subshell, to the listener.
+        void abort_queue(const xeus::xserver::listener& l, long polling_interval);
+
+    private:
+
+        struct subshell
+        {
+            std::thread m_thread;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::deque<xeus::xmessage> m_queue;
+            bool m_stop = false;
+        };
+
+        // Inproc socket pair waking up a thread polling sockets
+        class wakeup;
+
+        void run_impl() override;
+
+        bool process_controller_messages();
+        std::optional<xeus::xmessage> next_message();
+        void dispatch(xeus::xmessage msg);
+        void dispatch_concurrent(xeus::xmessage msg);
+        bool is_concurrent(const xeus::xmessage& msg) const;
+        bool is_responsive(const xeus::xmessage& msg) const;
+
+        static int pending_call(void* runner);
+        void schedule_pending_call();
+        void process_concurrent_messages();
+
+        void run_io();
+        void route(xeus::xmessage msg);
+        void send_outgoing_messages();
+        void start_io_thread();
+        void stop_io_thread();
+
+        bool post_to_subshell(xeus::xmessage& msg);
+        void post(subshell& sub, xeus::xmessage msg);
+        void run_subshell(subshell& sub);
+        void stop_subshell(subshell& sub);
+        void stop_subshells();
+
+        std::set<std::string> m_concurrent_types;
+        std::set<std::string> m_responsive_types;
+        std::deque<xeus::xmessage> m_deferred;
+        std::chrono::milliseconds m_poll_interval;
+        xeus::xserver* p_server;
+
+        // Messages read by the I/O thread for the main thread
+        std::mutex m_incoming_mutex;
+        std::deque<xeus::xmessage> m_incoming;
+        std::unique_ptr<wakeup> p_main_wakeup;
+
+        // Messages sent by the I/O thread
+        std::mutex m_outgoing_mutex;
+        std::deque<xeus::xmessage> m_outgoing;
+        std::unique_ptr<wakeup> p_io_wakeup;
+
+        std::atomic<bool> m_stop_io;
+        std::thread m_io_thread;
+
+        // Handles the lightweight requests received while the main
+        // thread is busy
+        subshell m_responder;
+
+        mutable std::mutex m_subshell_mutex;
+        std::map<std::string, std::unique_ptr<subshell>> m_subshells;
+        // Deleted subshells handle their queued messages before exiting,
+        // they are joined when the runner stops.
+        std::vector<std::unique_ptr<subshell>> m_deleted_subshells;
+
+        // Pending calls only hold a weak reference to the runner, calls
+        // still queued when it is destroyed, and run by Py_FinalizeEx, do
+        // nothing.
+        std::shared_ptr<shell_runner*> m_self;
+
+        std::atomic<bool> m_busy;
+        std::atomic<bool> m_call_pending;
+        bool m_in_concurrent_dispatch;
+    };
+
+    // Control runner answering the create_subshell, delete_subshell and
+    // list_subshell requests, which the kernel core of xeus does not know,
+    // with the subshells of a shell_runner. Other messages are forwarded
+    // to the kernel core.
+    class XEUS_PYTHON_API control_runner final : public xeus::xcontrol_runner
+    {
+    public:
+
+        explicit control_runner(shell_runner& shell);
+        ~control_runner() override = default;
+
+        // Server sending the replies, set once the server has been built
+        void set_server(xeus::xserver& server);
+
+    private:
+
+        void run_impl() override;
+
+        bool handle_subshell_request(const xeus::xmessage& msg);
+        void send_reply(const xeus::xmessage& request, const std::string& reply_type, nl::json content);
+
+        shell_runner& m_shell;
+        xeus::xserver* p_server;
+    };
+
+    // Builds a server whose shell channel runs on the main thread with
+    // a shell_runner dispatching comm messages and lightweight requests
+    // during cell execution, and hosting subshells. The shell messages sent
+    // through the returned server are routed to the I/O thread of the runner.
+    XEUS_PYTHON_API
+    std::unique_ptr<xeus::xserver> make_concurrent_server(xeus::xcontext& context,
+                                                          const xeus::xconfiguration& config,
+                                                          nl::json::error_handler_t eh);
+}
+
+#ifdef __GNUC__
+    #pragma GCC diagnostic pop
+#endif
+
+#endif
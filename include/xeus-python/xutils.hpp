@@ -12,6 +12,7 @@
 #ifndef XPYT_UTILS_HPP
 #define XPYT_UTILS_HPP
 
+#include <string>
 #include <vector>
 
 #include "nlohmann/json.hpp"
@@ -0,0 +1,132 @@
+#!/usr/bin/env python
+############################################################################
+# Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     #
+# Wolf Vollprecht                                                          #
+# Copyright (c) 2018, QuantStack                                           #
+#                                                                          #
+# Distributed under the terms of the BSD 3-Clause License.                 #
+#                                                                          #
+# The full license is in the file LICENSE, distributed with this software. #
+############################################################################
+
+"""Generates the C++ table of frozen modules embedded in xpython.
+
+The bytecode of every module of the given pure Python packages is marshaled
+into a C array. The marshal format depends on the Python version, this script
+must be run with the Python interpreter xpython is built against.
+"""
+
+import argparse
+import importlib.util
+import marshal
+import os
+import sys
+
+
+def collect_modules(name):
+    """Yields (module name, source path, is package) for a package or module,
+    without importing it."""
+    spec = importlib.util.find_spec(name)
+    if spec is None or spec.origin is None or not spec.origin.endswith('.py'):
+        raise SystemExit('{} is not a pure Python module'.format(name))
+
+    if spec.submodule_search_locations is None:
+        yield name, spec.origin, False
+        return
+
+    root = os.path.dirname(spec.origin)
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames[:] = sorted(
+            d for d in dirnames if os.path.isfile(os.path.join(dirpath, d, '__init__.py'))
+        )
+        relpath = os.path.relpath(dirpath, root)
+        package = name if relpath == os.curdir else name + '.' + relpath.replace(os.sep, '.')
+        for filename in sorted(filenames):
+            if not filename.endswith('.py'):
+                continue
+            path = os.path.join(dirpath, filename)
+            if filename == '__init__.py':
+                yield package, path, True
+            else:
+                yield package + '.' + filename[:-3], path, False
+
+
+def compile_module(path):
+    with open(path, 'rb') as f:
+        source = f.read()
+    return marshal.dumps(compile(source, path, 'exec', dont_inherit=True))
+
+
+def format_bytes(data, width=20):
+    lines = []
+    for i in range(0, len(data), width):
+        lines.append('        ' + ', '.join(str(b) for b in data[i:i + width]) + ',')
+    return '\n'.join(lines)
+
+
+HEADER = '''// Generated by freeze_modules.py for Python {version}, do not edit.
+
+#include "Python.h"
+
+#include "xfrozen_modules.hpp"
+
+// The marshal format may change between minor versions
+#if (PY_VERSION_HEX & 0xFFFF0000) != {hexversion:#010x}
+#error "The frozen modules were generated for another version of Python"
+#endif
+
+// Packages are flagged with a negative size before Python 3.11
+#if PY_VERSION_HEX >= 0x030B0000
+#define XPYT_FROZEN_ENTRY(name, code, is_package) {{name, code, static_cast<int>(sizeof(code)), is_package, nullptr}}
+#else
+#define XPYT_FROZEN_ENTRY(name, code, is_package) {{name, code, (is_package ? -1 : 1) * static_cast<int>(sizeof(code))}}
+#endif
+
+namespace
+{{
+'''
+
+FOOTER = '''
+}}
+
+namespace xpyt
+{{
+    const struct _frozen* get_frozen_modules()
+    {{
+        return frozen_modules;
+    }}
+}}
+'''
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('-o', '--output', required=True, help='generated C++ file')
+    parser.add_argument('modules', nargs='+', help='packages or modules to freeze')
+    args = parser.parse_args()
+
+    arrays = []
+    entries = []
+    for name in args.modules:
+        for module, path, is_package in collect_modules(name):
+            try:
+                data = compile_module(path)
+            except SyntaxError as e:
+                print('Skipping {}: {}'.format(module, e), file=sys.stderr)
+                continue
+            array = 'module_{}'.format(len(arrays))
+            arrays.append('    const unsigned char {}[] = {{\n{}\n    }};\n'.format(array, format_bytes(data)))
+            entries.append('        XPYT_FROZEN_ENTRY("{}", {}, {}),'.format(module, array, int(is_package)))
+
+    version = '{}.{}.{}'.format(*sys.version_info[:3])
+    with open(args.output, 'w') as f:
+        f.write(HEADER.format(version=version, hexversion=sys.hexversion & 0xFFFF0000))
+        f.write('\n'.join(arrays))
+        f.write('\n    const struct _frozen frozen_modules[] = {\n')
+        f.write('\n'.join(entries))
+        f.write('\n        {nullptr, nullptr, 0}\n    };\n')
+        f.write(FOOTER.format())
+
+
+if __name__ == '__main__':
+    main()
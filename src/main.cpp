@@ -8,6 +8,7 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <string>
@@ -36,9 +37,18 @@
 #include "xeus-python/xinterpreter_raw.hpp"
 #include "xeus-python/xdebugger.hpp"
 #include "xeus-python/xpaths.hpp"
+#include "xeus-python/xshell_runner.hpp"
 #include "xeus-python/xeus_python_config.hpp"
 #include "xeus-python/xutils.hpp"
 
+#include "xfork_server.hpp"
+#include "xkernel_host.hpp"
+#include "xtimer.hpp"
+
+#ifdef XPYT_FROZEN_KERNEL_MODULES
+#include "xfrozen_modules.hpp"
+#endif
+
 namespace py = pybind11;
 
 
@@ -71,6 +81,9 @@ int main(int argc, char* argv[])
     signal(SIGINT, xpyt::sigkill_handler);
 
     // Python initialization
+#ifdef XPYT_FROZEN_KERNEL_MODULES
+    xpyt::register_frozen_modules();
+#endif
     PyStatus status;
 
     PyConfig config;
@@ -114,12 +127,68 @@ int main(int argc, char* argv[])
     delete[] argw;
 
     // Instantiating the Python interpreter
+    auto python_init_start = std::chrono::steady_clock::now();
     py::scoped_interpreter guard;
+    xpyt::add_startup_timing("python_init", std::chrono::steady_clock::now() - python_init_start);
+
+    bool raw_mode = xpyt::extract_option("-r", "--raw", argc, argv);
+
+    // Forking pre-initialized kernels on request, the process only continues
+    // in the forked kernels. ZMQ contexts cannot be shared across a fork.
+    std::string fork_server_fifo = xpyt::extract_fifo_option("--fork-server", argc, argv);
+    std::string forked_connection_filename;
+    if (!fork_server_fifo.empty())
+    {
+        forked_connection_filename = xpyt::run_fork_server(fork_server_fifo, raw_mode);
+        xpyt::reset_startup_timer();
+    }
+
+    // Starting kernels in subinterpreters of this process on request, each
+    // with its own ZMQ context. The shell is served on the thread of the
+    // kernel, and the debugger relies on process-wide state.
+    std::string kernel_host_fifo = xpyt::extract_fifo_option("--kernel-host", argc, argv);
+    if (!kernel_host_fifo.empty())
+    {
+        xpyt::run_kernel_host(kernel_host_fifo, [raw_mode](const std::string& connection_filename)
+        {
+            using interpreter_ptr = std::unique_ptr<xeus::xinterpreter>;
+            interpreter_ptr interpreter = raw_mode
+                ? interpreter_ptr(new xpyt::raw_interpreter())
+                : interpreter_ptr(new xpyt::interpreter());
+
+            xeus::xkernel kernel(xeus::load_configuration(connection_filename),
+                                 xeus::get_user_name(),
+                                 xeus::make_zmq_context(),
+                                 std::move(interpreter),
+                                 xeus::make_xserver_shell_main,
+                                 xeus::make_in_memory_history_manager(),
+                                 xeus::make_console_logger(xeus::xlogger::msg_type,
+                                                           xeus::make_file_logger(xeus::xlogger::content, "xeus.log")));
+            kernel.start();
+        });
+        return 0;
+    }
 
     std::unique_ptr<xeus::xcontext> context = xeus::make_zmq_context();
 
+    // Dispatching comm messages while a cell is running
+    bool concurrent_comms = xpyt::extract_option("", "--concurrent-comms", argc, argv);
+    xeus::xkernel::server_builder base_server = concurrent_comms
+        ? xeus::xkernel::server_builder(xpyt::make_concurrent_server)
+        : xeus::xkernel::server_builder(xeus::make_xserver_shell_main);
+
+    // The sockets are bound when the server is built
+    auto make_server = [base_server](xeus::xcontext& ctx,
+                                     const xeus::xconfiguration& kernel_config,
+                                     nl::json::error_handler_t eh)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto server = base_server(ctx, kernel_config, eh);
+        xpyt::add_startup_timing("socket_bind", std::chrono::steady_clock::now() - start);
+        return server;
+    };
+
     // Instantiating the xeus xinterpreter
-    bool raw_mode = xpyt::extract_option("-r", "--raw", argc, argv);
     using interpreter_ptr = std::unique_ptr<xeus::xinterpreter>;
     interpreter_ptr interpreter;
     if (raw_mode)
@@ -134,7 +203,9 @@ int main(int argc, char* argv[])
     using history_manager_ptr = std::unique_ptr<xeus::xhistory_manager>;
     history_manager_ptr hist = xeus::make_in_memory_history_manager();
 
-    std::string connection_filename = xeus::extract_filename(argc, argv);
+    std::string connection_filename = forked_connection_filename.empty()
+        ? xeus::extract_filename(argc, argv)
+        : forked_connection_filename;
 
 #ifdef XEUS_PYTHON_PYPI_WARNING
     std::clog <<
@@ -154,7 +225,7 @@ int main(int argc, char* argv[])
                              xeus::get_user_name(),
                              std::move(context),
                              std::move(interpreter),
-                             xeus::make_xserver_shell_main,
+                             make_server,
                              std::move(hist),
                              xeus::make_console_logger(xeus::xlogger::msg_type,
                                                        xeus::make_file_logger(xeus::xlogger::content, "xeus.log")),
@@ -175,7 +246,7 @@ int main(int argc, char* argv[])
         xeus::xkernel kernel(xeus::get_user_name(),
                              std::move(context),
                              std::move(interpreter),
-                             xeus::make_xserver_shell_main,
+                             make_server,
                              std::move(hist),
                              nullptr,
                              xpyt::make_python_debugger,
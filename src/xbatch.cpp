@@ -0,0 +1,128 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xcomm.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xbatch.hpp"
+#include "xinput.hpp"
+#include "xinspect.hpp"
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    namespace
+    {
+        thread_local std::optional<std::size_t> current_batch_index;
+
+        // Makes the index of a batch cell available to the outputs it publishes
+        class batch_index_scope
+        {
+        public:
+
+            explicit batch_index_scope(std::size_t index)
+            {
+                current_batch_index = index;
+            }
+
+            ~batch_index_scope()
+            {
+                current_batch_index.reset();
+            }
+
+            batch_index_scope(const batch_index_scope&) = delete;
+            batch_index_scope& operator=(const batch_index_scope&) = delete;
+        };
+
+        void run_batch(xeus::xcomm& comm, const nl::json& data, const batch_cell_runner& runner)
+        {
+            const nl::json& cells = data.contains("cells") ? data["cells"] : nl::json::array();
+            bool stop_on_error = data.value("stop_on_error", true);
+
+            std::string status = "ok";
+            std::size_t executed = 0;
+            {
+                py::gil_scoped_acquire acquire;
+                // The batch runs headless, the frontend cannot answer input requests
+                input_redirection input_guard(false);
+
+                for (std::size_t index = 0; index < cells.size(); ++index)
+                {
+                    comm.send(nl::json::object(), {{"event", "cell_start"}, {"index", index}}, {});
+
+                    nl::json result;
+                    {
+                        batch_index_scope index_scope(index);
+                        result = cells[index].is_string()
+                            ? runner(cells[index].get<std::string>(), index)
+                            : nl::json({{"status", "error"}, {"ename", "TypeError"}, {"evalue", "cells must be strings"}});
+                    }
+                    ++executed;
+
+                    bool failed = result.value("status", "ok") != "ok";
+                    result["event"] = "cell_end";
+                    result["index"] = index;
+                    comm.send(nl::json::object(), std::move(result), {});
+
+                    if (failed)
+                    {
+                        status = "error";
+                        if (stop_on_error)
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                // Namespace watchers do not track mutated objects
+                bump_namespace_version();
+            }
+
+            comm.close(nl::json::object(),
+                       {{"event", "batch_end"}, {"status", status}, {"executed", executed}},
+                       {});
+        }
+    }
+
+    nl::json add_batch_metadata(nl::json metadata)
+    {
+        if (current_batch_index)
+        {
+            if (!metadata.is_object())
+            {
+                metadata = nl::json::object();
+            }
+            metadata["xeus_python"]["batch_index"] = *current_batch_index;
+        }
+        return metadata;
+    }
+
+    void register_batch_target(xeus::xcomm_manager& manager, batch_cell_runner runner)
+    {
+        auto target_callback = [runner](xeus::xcomm&& comm, const xeus::xmessage& request)
+        {
+            const nl::json& content = request.content();
+            nl::json data = content.contains("data") ? content["data"] : nl::json::object();
+            run_batch(comm, data, runner);
+        };
+
+        manager.register_comm_target("xeus-python.batch", target_callback);
+    }
+}
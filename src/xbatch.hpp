@@ -0,0 +1,47 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_BATCH_HPP
+#define XPYT_BATCH_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xcomm.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    // Runs a cell of a batch with the GIL held, publishes its outputs and
+    // errors, and returns its status ("ok" or "error", with ename, evalue
+    // and traceback on error).
+    using batch_cell_runner = std::function<nl::json(const std::string& code, std::size_t index)>;
+
+    // Registers the "xeus-python.batch" comm target. Opening a comm on this
+    // target with the data {"cells": [...], "stop_on_error": true} runs the
+    // cells in order within a single shell request. Each cell is bracketed
+    // by "cell_start" and "cell_end" comm messages carrying its index, so
+    // the outputs published in between can be attributed to it. The comm is
+    // closed with a "batch_end" message once the batch has completed.
+    // Results are published with the execution count of the next execute
+    // request, as IPython does for cells that are not stored in the history.
+    void register_batch_target(xeus::xcomm_manager& manager, batch_cell_runner runner);
+
+    // Returns the metadata of an output published on this thread, with the
+    // index of the running batch cell, if any, under
+    // {"xeus_python": {"batch_index": index}}.
+    nl::json add_batch_metadata(nl::json metadata);
+}
+
+#endif
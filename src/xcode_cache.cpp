@@ -0,0 +1,294 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "pybind11/pybind11.h"
+
+#include "xcode_cache.hpp"
+#include "xtimer.hpp"
+
+namespace py = pybind11;
+namespace fs = std::filesystem;
+using namespace pybind11::literals;
+
+namespace xpyt
+{
+    namespace
+    {
+        constexpr std::size_t default_code_cache_size = 128;
+
+        // Code objects loaded from the disk cache hold the file name of
+        // the session that compiled them, which embeds the process id.
+        py::object relocate_code(const py::object& code, const py::str& filename)
+        {
+            py::list consts;
+            for (py::handle c : py::tuple(code.attr("co_consts")))
+            {
+                if (PyCode_Check(c.ptr()))
+                {
+                    consts.append(relocate_code(py::reinterpret_borrow<py::object>(c), filename));
+                }
+                else
+                {
+                    consts.append(c);
+                }
+            }
+            return code.attr("replace")("co_filename"_a = filename, "co_consts"_a = py::tuple(consts));
+        }
+    }
+
+    /******************************
+     * xcode_cache implementation *
+     ******************************/
+
+    xcode_cache::xcode_cache(std::size_t capacity, std::string directory)
+        : m_capacity(capacity)
+        , m_directory(std::move(directory))
+        , m_hits(0)
+        , m_misses(0)
+    {
+    }
+
+    xcode_cache xcode_cache::from_environment()
+    {
+        std::size_t capacity = default_code_cache_size;
+        if (const char* size = std::getenv("XPYTHON_CODE_CACHE_SIZE"))
+        {
+            try
+            {
+                capacity = std::stoul(size);
+            }
+            catch (std::exception&)
+            {
+            }
+        }
+
+        const char* directory = std::getenv("XPYTHON_CODE_CACHE_DIR");
+        return xcode_cache(capacity, directory != nullptr ? directory : "");
+    }
+
+    const xcompiled_cell& xcode_cache::get(const std::string& code, const std::string& filename, xtimer& timer)
+    {
+        auto it = m_index.find(filename);
+        if (it != m_index.end() && it->second->second.m_code == code)
+        {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            ++m_hits;
+            return it->second->second;
+        }
+
+        ++m_misses;
+        xcompiled_cell cell;
+        if (!load(code, filename, cell))
+        {
+            cell = compile(code, filename, timer);
+            store(filename, cell);
+        }
+        return insert(filename, std::move(cell));
+    }
+
+    void xcode_cache::clear()
+    {
+        m_index.clear();
+        m_entries.clear();
+        m_uncached = xcompiled_cell();
+    }
+
+    std::size_t xcode_cache::size() const
+    {
+        return m_entries.size();
+    }
+
+    std::size_t xcode_cache::capacity() const
+    {
+        return m_capacity;
+    }
+
+    std::size_t xcode_cache::hits() const
+    {
+        return m_hits;
+    }
+
+    std::size_t xcode_cache::misses() const
+    {
+        return m_misses;
+    }
+
+    xcompiled_cell xcode_cache::compile(const std::string& code, const std::string& filename, xtimer& timer)
+    {
+        if (!m_ast)
+        {
+            m_ast = py::module::import("ast");
+            m_builtins = py::module::import("builtins");
+        }
+
+        xcompiled_cell cell;
+        cell.m_code = code;
+
+        // Parse code to AST
+        py::object code_ast;
+        {
+            xtimer::scope timing(timer, "parse");
+            code_ast = m_ast.attr("parse")(code, "<string>", "exec");
+        }
+
+        xtimer::scope timing(timer, "compile");
+        py::list expressions = code_ast.attr("body");
+
+        // If the last statement is an expression, we compile it separately
+        // in an interactive mode (This will trigger the display hook)
+        if (py::len(expressions) != 0)
+        {
+            py::object last_stmt = expressions[py::len(expressions) - 1];
+            if (py::isinstance(last_stmt, m_ast.attr("Expr")))
+            {
+                code_ast.attr("body").attr("pop")();
+
+                py::list interactive_nodes;
+                interactive_nodes.append(last_stmt);
+
+                py::object interactive_ast = m_ast.attr("Interactive")(interactive_nodes);
+                cell.m_interactive = m_builtins.attr("compile")(interactive_ast, filename, "single");
+            }
+        }
+
+        cell.m_body = m_builtins.attr("compile")(code_ast, filename, "exec");
+        return cell;
+    }
+
+    bool xcode_cache::load(const std::string& code, const std::string& filename, xcompiled_cell& cell)
+    {
+        if (m_directory.empty())
+        {
+            return false;
+        }
+
+        std::ifstream in(disk_path(filename), std::ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        // A corrupted or stale entry is simply recompiled
+        try
+        {
+            py::tuple entry = m_marshal.attr("loads")(py::bytes(content));
+            if (entry.size() != 3 || entry[0].cast<std::string>() != code)
+            {
+                return false;
+            }
+
+            py::str pyfilename(filename);
+            cell.m_code = code;
+            cell.m_body = relocate_code(entry[1], pyfilename);
+            if (!entry[2].is_none())
+            {
+                cell.m_interactive = relocate_code(entry[2], pyfilename);
+            }
+            return true;
+        }
+        catch (py::error_already_set&)
+        {
+            return false;
+        }
+        catch (py::cast_error&)
+        {
+            return false;
+        }
+    }
+
+    void xcode_cache::store(const std::string& filename, const xcompiled_cell& cell)
+    {
+        if (m_directory.empty())
+        {
+            return;
+        }
+
+        std::string path = disk_path(filename);
+        std::string tmp_path = path + ".tmp";
+        try
+        {
+            py::object interactive = cell.m_interactive ? cell.m_interactive : py::none();
+            py::bytes content = m_marshal.attr("dumps")(py::make_tuple(cell.m_code, cell.m_body, interactive));
+
+            std::error_code ec;
+            fs::create_directories(m_directory, ec);
+
+            // Writing to a temporary file first so that concurrent kernels
+            // never read a partially written entry.
+            {
+                std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+                if (!out)
+                {
+                    return;
+                }
+                std::string data = content;
+                out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            }
+            fs::rename(tmp_path, path, ec);
+            if (ec)
+            {
+                fs::remove(tmp_path, ec);
+            }
+        }
+        catch (py::error_already_set&)
+        {
+        }
+    }
+
+    std::string xcode_cache::disk_path(const std::string& filename)
+    {
+        if (!m_marshal)
+        {
+            m_marshal = py::module::import("marshal");
+            // Marshalled code objects are only valid for the bytecode version
+            // that produced them.
+            m_magic = py::module::import("importlib.util").attr("MAGIC_NUMBER").attr("hex")();
+        }
+
+        std::string stem = fs::path(filename).stem().string();
+        return (fs::path(m_directory) / (stem + "-" + m_magic.cast<std::string>() + ".xpyc")).string();
+    }
+
+    const xcompiled_cell& xcode_cache::insert(const std::string& filename, xcompiled_cell cell)
+    {
+        if (m_capacity == 0)
+        {
+            m_uncached = std::move(cell);
+            return m_uncached;
+        }
+
+        auto it = m_index.find(filename);
+        if (it != m_index.end())
+        {
+            it->second->second = std::move(cell);
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return m_entries.front().second;
+        }
+
+        m_entries.emplace_front(filename, std::move(cell));
+        m_index[filename] = m_entries.begin();
+        while (m_entries.size() > m_capacity)
+        {
+            m_index.erase(m_entries.back().first);
+            m_entries.pop_back();
+        }
+        return m_entries.front().second;
+    }
+}
@@ -0,0 +1,99 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_CODE_CACHE_HPP
+#define XPYT_CODE_CACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "pybind11/pybind11.h"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    class xtimer;
+
+    /******************
+     * xcompiled_cell *
+     ******************/
+
+    struct xcompiled_cell
+    {
+        std::string m_code;
+        // Cell body compiled in "exec" mode
+        py::object m_body;
+        // Last statement of the cell compiled in "single" mode when it is an
+        // expression, so that it triggers the display hook. Null otherwise.
+        py::object m_interactive;
+    };
+
+    /***************************
+     * xcode_cache declaration *
+     ***************************/
+
+    // LRU cache of compiled cells, keyed by the cell file name which
+    // embeds the hash of the cell content. When a directory is given,
+    // compiled cells are also marshalled to disk so that they survive
+    // kernel restarts.
+    class xcode_cache
+    {
+    public:
+
+        explicit xcode_cache(std::size_t capacity, std::string directory = "");
+
+        // Builds a cache configured with the XPYTHON_CODE_CACHE_SIZE and
+        // XPYTHON_CODE_CACHE_DIR environment variables.
+        static xcode_cache from_environment();
+
+        // Returns the compiled cell, parsing and compiling it on cache miss.
+        // Must be called with the GIL held.
+        const xcompiled_cell& get(const std::string& code, const std::string& filename, xtimer& timer);
+
+        void clear();
+        std::size_t size() const;
+        std::size_t capacity() const;
+        std::size_t hits() const;
+        std::size_t misses() const;
+
+    private:
+
+        using entry_type = std::pair<std::string, xcompiled_cell>;
+        using list_type = std::list<entry_type>;
+
+        xcompiled_cell compile(const std::string& code, const std::string& filename, xtimer& timer);
+        bool load(const std::string& code, const std::string& filename, xcompiled_cell& cell);
+        void store(const std::string& filename, const xcompiled_cell& cell);
+        std::string disk_path(const std::string& filename);
+
+        const xcompiled_cell& insert(const std::string& filename, xcompiled_cell cell);
+
+        std::size_t m_capacity;
+        std::string m_directory;
+        list_type m_entries;
+        std::unordered_map<std::string, list_type::iterator> m_index;
+        std::size_t m_hits;
+        std::size_t m_misses;
+
+        // Compiling without a cache still requires a single entry
+        xcompiled_cell m_uncached;
+
+        py::object m_ast;
+        py::object m_builtins;
+        py::object m_marshal;
+        py::object m_magic;
+    };
+}
+
+#endif
@@ -8,8 +8,16 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
+
 #include "nlohmann/json.hpp"
 
 #include "xeus/xcomm.hpp"
@@ -25,6 +33,7 @@
 
 #include "xcomm.hpp"
 #include "xinternal_utils.hpp"
+#include "xshared_memory.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -32,6 +41,106 @@ using namespace pybind11::literals;
 
 namespace xpyt
 {
+    raw_encoding make_raw_encoding(bool raw, const std::string& encoding)
+    {
+        if (!raw)
+        {
+            return raw_encoding::none;
+        }
+        else if (encoding == "json")
+        {
+            return raw_encoding::json;
+        }
+        else if (encoding == "msgpack")
+        {
+            return raw_encoding::msgpack;
+        }
+        throw std::invalid_argument("Unknown raw comm encoding '" + encoding + "', expected 'json' or 'msgpack'");
+    }
+
+    namespace
+    {
+        py::bytes cppcontent_to_pybytes(const nl::json& content, raw_encoding encoding)
+        {
+            if (encoding == raw_encoding::msgpack)
+            {
+                std::vector<std::uint8_t> packed = nl::json::to_msgpack(content);
+                return py::bytes(reinterpret_cast<const char*>(packed.data()), packed.size());
+            }
+            return py::bytes(content.dump());
+        }
+
+        // Moves the buffers still referenced by the handler, directly or
+        // through a memoryview or an object exporting one, to their views.
+        // The message is owned by the server, which does not read its
+        // buffers once the handlers have returned.
+        void detach_message_buffers(const xeus::xmessage& msg, py::list& views, const std::vector<py::object>& owners)
+        {
+            views = py::list();
+            const xeus::buffer_sequence& buffers = msg.buffers();
+            for (std::size_t i = 0; i < owners.size(); ++i)
+            {
+                if (owners[i].ref_count() > 1)
+                {
+                    owners[i].cast<xmessage_buffer&>().detach(const_cast<xeus::binary_buffer&>(buffers[i]));
+                }
+            }
+        }
+
+        void call_raw_callback(const xcomm::python_raw_callback_type& py_callback,
+                               const xeus::xmessage& msg,
+                               raw_encoding encoding)
+        {
+            std::vector<py::object> owners;
+            py::list views;
+            for (const xeus::binary_buffer& buffer : msg.buffers())
+            {
+                owners.push_back(py::cast(xmessage_buffer(buffer)));
+                views.append(py::memoryview(owners.back()));
+            }
+            try
+            {
+                py_callback(cppcontent_to_pybytes(msg.content(), encoding), views);
+            }
+            catch (...)
+            {
+                // The traceback may reference the views as well
+                detach_message_buffers(msg, views, owners);
+                throw;
+            }
+            detach_message_buffers(msg, views, owners);
+        }
+    }
+
+    /**********************************
+     * xmessage_buffer implementation *
+     **********************************/
+
+    xmessage_buffer::xmessage_buffer(const xeus::binary_buffer& buffer)
+        : p_data(buffer.data())
+        , m_size(buffer.size())
+    {
+    }
+
+    py::buffer_info xmessage_buffer::buffer_info() const
+    {
+        return py::buffer_info(
+            const_cast<char*>(p_data),
+            1,
+            py::format_descriptor<std::uint8_t>::format(),
+            1,
+            { static_cast<py::ssize_t>(m_size) },
+            { static_cast<py::ssize_t>(1) },
+            true
+        );
+    }
+
+    void xmessage_buffer::detach(xeus::binary_buffer& buffer)
+    {
+        // Moving the vector keeps its storage, the exported pointers remain
+        // valid.
+        m_storage = std::move(buffer);
+    }
 
     /************************
      * xcomm implementation *
@@ -48,8 +157,28 @@ namespace xpyt
     {
     }
 
+    xcomm::xcomm(xcomm&& comm)
+        : m_comm(std::move(comm.m_comm))
+        , m_msg_callback(std::move(comm.m_msg_callback))
+        , m_close_callback(std::move(comm.m_close_callback))
+        , m_transfers(std::move(comm.m_transfers))
+        , m_shm_threshold(comm.m_shm_threshold)
+        , m_shm_segments(std::move(comm.m_shm_segments))
+        , m_handler_installed(false)
+    {
+        // The handlers of the moved comm capture its address, they must be
+        // bound to the new one.
+        if (comm.m_handler_installed)
+        {
+            install_message_handler();
+        }
+        comm.m_handler_installed = false;
+        comm.m_shm_segments.clear();
+    }
+
     xcomm::~xcomm()
     {
+        release_shared_buffers();
     }
 
     std::string xcomm::comm_id() const
@@ -64,27 +193,389 @@ namespace xpyt
 
     void xcomm::close(const py::object& data, const py::object& metadata, const py::object& buffers)
     {
+        transfer_map transfers;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            transfers.swap(m_transfers);
+        }
+        release_shared_buffers();
         m_comm.close(metadata, data, pylist_to_cpp_buffers(buffers));
     }
 
     void xcomm::send(const py::object& data, const py::object& metadata, const py::object& buffers)
     {
-        m_comm.send(metadata, data, pylist_to_cpp_buffers(buffers));
+        std::size_t shm_threshold = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            shm_threshold = m_shm_threshold;
+        }
+
+        if (shm_threshold == 0)
+        {
+            m_comm.send(metadata, data, pylist_to_cpp_buffers(buffers));
+        }
+        else
+        {
+            nl::json cpp_metadata = metadata;
+            buffers_sequence cpp_buffers = to_shared_buffers(buffers, cpp_metadata, shm_threshold);
+            m_comm.send(std::move(cpp_metadata), data, std::move(cpp_buffers));
+        }
     }
 
-    void xcomm::on_msg(const python_callback_type& callback)
+    void xcomm::on_msg(const py::object& callback, bool raw, const std::string& encoding)
     {
-        m_comm.on_message(cpp_callback(callback));
+        raw_encoding enc = make_raw_encoding(raw, encoding);
+        callback_ptr msg_callback = enc == raw_encoding::none
+            ? make_callback(cpp_callback(callback.cast<python_callback_type>()))
+            : make_callback(cpp_raw_callback(callback.cast<python_raw_callback_type>(), enc));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_msg_callback.swap(msg_callback);
+        }
+        install_message_handler();
     }
 
     void xcomm::on_close(const python_callback_type& callback)
     {
-        m_comm.on_close(cpp_callback(callback));
+        callback_ptr close_callback = make_callback(cpp_callback(callback));
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_close_callback.swap(close_callback);
+        }
+        install_message_handler();
+    }
+
+    std::string xcomm::send_stream(const py::buffer& buffer,
+                                   const py::object& data,
+                                   const py::object& metadata,
+                                   std::size_t chunk_size,
+                                   std::size_t window,
+                                   const py::object& on_complete)
+    {
+        if (chunk_size == 0 || window == 0)
+        {
+            throw std::invalid_argument("chunk_size and window must be strictly positive");
+        }
+
+        // The chunks are sliced from the raw memory of the buffer, which
+        // must therefore be C-contiguous.
+        auto view = std::make_unique<Py_buffer>();
+        if (PyObject_GetBuffer(buffer.ptr(), view.get(), PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        {
+            PyErr_Clear();
+            py::bytes copy = py::memoryview(buffer).attr("tobytes")();
+            if (PyObject_GetBuffer(copy.ptr(), view.get(), PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+            {
+                throw py::error_already_set();
+            }
+        }
+
+        xchunked_transfer transfer;
+        transfer.m_buffer = std::make_unique<py::buffer_info>(view.release());
+        transfer.m_metadata = metadata;
+        transfer.m_on_complete = on_complete;
+        transfer.m_size = static_cast<std::size_t>(transfer.m_buffer->size * transfer.m_buffer->itemsize);
+        transfer.m_chunk_size = chunk_size;
+        transfer.m_chunk_count = std::max<std::size_t>(1, (transfer.m_size + chunk_size - 1) / chunk_size);
+        transfer.m_window = window;
+        transfer.m_next_chunk = 0;
+        transfer.m_acked_chunks = 0;
+
+        std::string stream_id = xeus::new_xguid();
+
+        // The user data only travels with the first chunk
+        nl::json start;
+        start["method"] = "stream_start";
+        start["stream_id"] = stream_id;
+        start["chunks"] = transfer.m_chunk_count;
+        start["size"] = transfer.m_size;
+        start["data"] = data;
+        m_comm.send(metadata, std::move(start), buffers_sequence());
+
+        install_message_handler();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_transfers.emplace(stream_id, std::move(transfer)).first;
+        send_chunks(stream_id, it->second);
+        return stream_id;
+    }
+
+    void xcomm::cancel_stream(const std::string& stream_id)
+    {
+        // The transfer holds Python objects, it is destroyed outside the lock
+        transfer_map::node_type node;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            node = m_transfers.extract(stream_id);
+        }
+    }
+
+    std::size_t xcomm::pending_streams() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_transfers.size();
+    }
+
+    void xcomm::enable_shared_memory(std::size_t threshold)
+    {
+#if XPYT_HAS_SHARED_MEMORY
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_shm_threshold = std::max<std::size_t>(threshold, 1);
+        }
+        install_message_handler();
+#else
+        (void)threshold;
+        throw std::runtime_error("Shared memory comm buffers are not supported on this platform");
+#endif
+    }
+
+    void xcomm::disable_shared_memory()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shm_threshold = 0;
+    }
+
+    auto xcomm::to_shared_buffers(const py::object& buffers, nl::json& metadata, std::size_t shm_threshold) -> buffers_sequence
+    {
+        buffers_sequence res;
+        if (buffers.is_none())
+        {
+            return res;
+        }
+
+        nl::json handles = nl::json::array();
+        for (py::handle buffer : buffers)
+        {
+            Py_buffer view;
+            if (PyObject_GetBuffer(buffer.ptr(), &view, PyBUF_ANY_CONTIGUOUS) != 0)
+            {
+                // Non contiguous buffers go through the regular copy
+                PyErr_Clear();
+                py::list single;
+                single.append(buffer);
+                res.push_back(std::move(pylist_to_cpp_buffers(single).front()));
+                continue;
+            }
+
+            std::size_t size = static_cast<std::size_t>(view.len);
+            const char* ptr = static_cast<const char*>(view.buf);
+            if (size < shm_threshold)
+            {
+                res.emplace_back(ptr, ptr + size);
+                PyBuffer_Release(&view);
+                continue;
+            }
+
+            std::string name;
+            try
+            {
+                name = get_shm_registry().create(ptr, size);
+            }
+            catch (...)
+            {
+                PyBuffer_Release(&view);
+                throw;
+            }
+            PyBuffer_Release(&view);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_shm_segments.insert(name);
+            }
+            handles.push_back({{"index", res.size()}, {"name", name}, {"size", size}});
+            // Keep an empty placeholder so that buffer indices are preserved
+            res.emplace_back();
+        }
+
+        if (!handles.empty())
+        {
+            metadata["shm_buffers"] = std::move(handles);
+        }
+        return res;
+    }
+
+    void xcomm::release_shared_buffers()
+    {
+        std::set<std::string> segments;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            segments.swap(m_shm_segments);
+        }
+
+        xshm_registry& registry = get_shm_registry();
+        for (const std::string& name : segments)
+        {
+            registry.release(name);
+        }
+    }
+
+    void xcomm::install_message_handler()
+    {
+        // The handlers capture this, the move constructor installs them
+        // again on the new comm.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_handler_installed)
+        {
+            m_comm.on_message([this](const xeus::xmessage& msg)
+            {
+                handle_message(msg);
+            });
+            m_comm.on_close([this](const xeus::xmessage& msg)
+            {
+                handle_close(msg);
+            });
+            m_handler_installed = true;
+        }
+    }
+
+    void xcomm::handle_message(const xeus::xmessage& msg)
+    {
+        const nl::json& content = msg.content();
+        auto data = content.find("data");
+        bool internal = false;
+        callback_ptr msg_callback;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            internal = !m_transfers.empty() || !m_shm_segments.empty();
+            msg_callback = m_msg_callback;
+        }
+
+        bool handled = false;
+        if (internal && data != content.end() && data->is_object())
+        {
+            XPYT_HOLDING_GIL(handled = handle_internal_message(*data))
+        }
+
+        if (!handled && msg_callback)
+        {
+            (*msg_callback)(msg);
+        }
+    }
+
+    void xcomm::handle_close(const xeus::xmessage& msg)
+    {
+        // The frontend will not acknowledge nor release anything anymore
+        transfer_map transfers;
+        callback_ptr close_callback;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            transfers.swap(m_transfers);
+            close_callback = m_close_callback;
+        }
+        if (!transfers.empty())
+        {
+            XPYT_HOLDING_GIL(transfers.clear())
+        }
+        release_shared_buffers();
+
+        if (close_callback)
+        {
+            (*close_callback)(msg);
+        }
+    }
+
+    bool xcomm::handle_internal_message(const nl::json& data)
+    {
+        std::string method = data.value("method", "");
+        if (method == "shm_release")
+        {
+            auto names = data.find("names");
+            if (names != data.end() && names->is_array())
+            {
+                for (const auto& name : *names)
+                {
+                    // Entries are sent by the frontend, invalid ones are ignored
+                    if (!name.is_string())
+                    {
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto it = m_shm_segments.find(name.get<std::string>());
+                    if (it != m_shm_segments.end())
+                    {
+                        get_shm_registry().release(*it);
+                        m_shm_segments.erase(it);
+                    }
+                }
+            }
+            return true;
+        }
+        else if (method == "stream_ack" || method == "stream_cancel")
+        {
+            return handle_stream_message(method, data);
+        }
+        return false;
+    }
+
+    bool xcomm::handle_stream_message(const std::string& method, const nl::json& data)
+    {
+        std::string stream_id = data.value("stream_id", "");
+
+        // Completed or cancelled transfers are destroyed, and on_complete
+        // called, outside the lock
+        transfer_map::node_type node;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_transfers.find(stream_id);
+            if (it == m_transfers.end())
+            {
+                // Unknown or already completed transfer, nothing to forward.
+                return true;
+            }
+
+            if (method == "stream_cancel")
+            {
+                node = m_transfers.extract(it);
+                return true;
+            }
+
+            // Acknowledgements are cumulative: acking seq means that all the
+            // chunks up to seq have been received.
+            xchunked_transfer& transfer = it->second;
+            std::size_t acked = data.value("seq", std::size_t(0)) + 1;
+            transfer.m_acked_chunks = std::min(std::max(transfer.m_acked_chunks, acked), transfer.m_next_chunk);
+
+            if (transfer.m_acked_chunks != transfer.m_chunk_count)
+            {
+                send_chunks(stream_id, transfer);
+                return true;
+            }
+            node = m_transfers.extract(it);
+        }
+
+        py::object on_complete = node.mapped().m_on_complete;
+        if (!on_complete.is_none())
+        {
+            on_complete(stream_id);
+        }
+        return true;
+    }
+
+    void xcomm::send_chunks(const std::string& stream_id, xchunked_transfer& transfer)
+    {
+        const char* base = static_cast<const char*>(transfer.m_buffer->ptr);
+        while (transfer.m_next_chunk < transfer.m_chunk_count &&
+               transfer.m_next_chunk - transfer.m_acked_chunks < transfer.m_window)
+        {
+            std::size_t offset = transfer.m_next_chunk * transfer.m_chunk_size;
+            std::size_t length = std::min(transfer.m_chunk_size, transfer.m_size - offset);
+
+            nl::json chunk;
+            chunk["method"] = "stream_chunk";
+            chunk["stream_id"] = stream_id;
+            chunk["seq"] = transfer.m_next_chunk;
+            chunk["offset"] = offset;
+
+            buffers_sequence buffers;
+            buffers.emplace_back(base + offset, base + offset + length);
+            m_comm.send(transfer.m_metadata, std::move(chunk), std::move(buffers));
+            ++transfer.m_next_chunk;
+        }
     }
 
     xeus::xtarget* xcomm::target(const py::object& target_name) const
     {
-        return xeus::get_interpreter().comm_manager().target(target_name.cast<std::string>());
+        return get_kernel_interpreter().comm_manager().target(target_name.cast<std::string>());
     }
 
     xeus::xguid xcomm::id(const py::kwargs& kwargs) const
@@ -100,22 +591,47 @@ namespace xpyt
         }
     }
 
+    auto xcomm::make_callback(cpp_callback_type callback) const -> callback_ptr
+    {
+        return std::make_shared<const cpp_callback_type>(std::move(callback));
+    }
+
     auto xcomm::cpp_callback(const python_callback_type& py_callback) const -> cpp_callback_type
     {
-        return [this, py_callback](const xeus::xmessage& msg)
+        return [py_callback](const xeus::xmessage& msg)
         {
             XPYT_HOLDING_GIL(py_callback(cppmessage_to_pymessage(msg)))
         };
     }
 
-    void xcomm_manager::register_target(const py::str& target_name, const py::object& callback)
+    auto xcomm::cpp_raw_callback(const python_raw_callback_type& py_callback, raw_encoding encoding) const -> cpp_callback_type
     {
-        auto target_callback = [callback] (xeus::xcomm&& comm, const xeus::xmessage& msg)
+        return [py_callback, encoding](const xeus::xmessage& msg)
         {
-            XPYT_HOLDING_GIL(callback(xcomm(std::move(comm)), cppmessage_to_pymessage(msg)));
+            XPYT_HOLDING_GIL(call_raw_callback(py_callback, msg, encoding))
+        };
+    }
+
+    void xcomm_manager::register_target(const py::str& target_name, const py::object& callback, bool raw, const std::string& encoding)
+    {
+        raw_encoding enc = make_raw_encoding(raw, encoding);
+        auto target_callback = [callback, enc] (xeus::xcomm&& comm, const xeus::xmessage& msg)
+        {
+            if (enc == raw_encoding::none)
+            {
+                XPYT_HOLDING_GIL(callback(xcomm(std::move(comm)), cppmessage_to_pymessage(msg)));
+            }
+            else
+            {
+                auto raw_callback = [&callback, &comm](py::bytes content, py::list buffers)
+                {
+                    callback(xcomm(std::move(comm)), content, buffers);
+                };
+                XPYT_HOLDING_GIL(call_raw_callback(raw_callback, msg, enc))
+            }
         };
 
-        xeus::get_interpreter().comm_manager().register_comm_target(
+        get_kernel_interpreter().comm_manager().register_comm_target(
             static_cast<std::string>(target_name), target_callback
         );
     }
@@ -135,23 +651,37 @@ namespace xpyt
             )
             .def("close", &xcomm::close, "data"_a=py::dict(), "metadata"_a=py::dict(), "buffers"_a=py::list())
             .def("send", &xcomm::send, "data"_a=py::dict(), "metadata"_a=py::dict(), "buffers"_a=py::list())
-            .def("on_msg", &xcomm::on_msg)
+            .def("on_msg", &xcomm::on_msg, "callback"_a, "raw"_a=false, "encoding"_a="json")
             .def("on_close", &xcomm::on_close)
+            .def("send_stream", &xcomm::send_stream,
+                 "buffer"_a, "data"_a=py::dict(), "metadata"_a=py::dict(),
+                 "chunk_size"_a=1 << 20, "window"_a=4, "on_complete"_a=py::none())
+            .def("cancel_stream", &xcomm::cancel_stream, "stream_id"_a)
+            .def_property_readonly("pending_streams", &xcomm::pending_streams)
+            .def("enable_shared_memory", &xcomm::enable_shared_memory, "threshold"_a=1 << 20)
+            .def("disable_shared_memory", &xcomm::disable_shared_memory)
             .def_property_readonly("comm_id", &xcomm::comm_id)
             .def_property_readonly("kernel", &xcomm::kernel);
 
+        py::class_<xmessage_buffer>(comm_module, "MessageBuffer", py::buffer_protocol())
+            .def_buffer(&xmessage_buffer::buffer_info);
+
         py::class_<xcomm_manager>(comm_module, "CommManager")
             .def(py::init<>())
-            .def("register_target", &xcomm_manager::register_target);
+            .def("register_target", &xcomm_manager::register_target,
+                 "target_name"_a, "callback"_a, "raw"_a=false, "encoding"_a="json");
 
-        comm_module.def("create_comm", [&comm_module](py::args objs, py::kwargs kw) {
-            return comm_module.attr("Comm")(*objs, **kw);
-        });
+        comm_module.def("read_shared_memory", &read_shared_memory, "name"_a, "size"_a);
 
-        comm_module.def("get_comm_manager", [&comm_module]() {
-            static py::object comm_manager = comm_module.attr("CommManager")();
+        comm_module.def("create_comm", [](py::args objs, py::kwargs kw) {
+            return get_comm_module().attr("Comm")(*objs, **kw);
+        });
 
-            return comm_manager;
+        comm_module.def("get_comm_manager", []() {
+            static xinterpreter_singleton comm_manager("comm_manager", []() -> py::object {
+                return get_comm_module().attr("CommManager")();
+            });
+            return comm_manager.get();
         });
 
         return comm_module;
@@ -159,7 +689,7 @@ namespace xpyt
 
     py::module get_comm_module()
     {
-        static py::module comm_module = get_comm_module_impl();
-        return comm_module;
+        static xinterpreter_singleton comm_module("comm", get_comm_module_impl);
+        return py::reinterpret_borrow<py::module>(comm_module.get());
     }
 }
@@ -11,23 +11,68 @@
 #ifndef XPYT_COMM_HPP
 #define XPYT_COMM_HPP
 
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus/xcomm.hpp"
+
 #include "pybind11/pybind11.h"
 
 namespace py = pybind11;
+namespace nl = nlohmann;
 
 namespace xpyt
 {
+    // Raw handlers receive the message content serialized with one of
+    // these encodings instead of a Python dict, and the buffers as
+    // read-only memoryviews of the message.
+    enum class raw_encoding
+    {
+        none,
+        json,
+        msgpack
+    };
+
+    raw_encoding make_raw_encoding(bool raw, const std::string& encoding);
+
+    // Read-only view of a message buffer, exported to the raw handlers
+    // without copy. If the handler still references the view when it
+    // returns, the storage of the buffer is moved to the view, so that
+    // it outlives the message.
+    class xmessage_buffer
+    {
+    public:
+
+        explicit xmessage_buffer(const xeus::binary_buffer& buffer);
+
+        py::buffer_info buffer_info() const;
+        void detach(xeus::binary_buffer& buffer);
+
+    private:
+
+        const char* p_data;
+        std::size_t m_size;
+        xeus::binary_buffer m_storage;
+    };
+
     class xcomm
     {
     public:
 
         using python_callback_type = std::function<void(py::object)>;
+        using python_raw_callback_type = std::function<void(py::bytes, py::list)>;
         using cpp_callback_type = std::function<void(const xeus::xmessage&)>;
         using buffers_sequence = xeus::buffer_sequence;
 
         xcomm(const py::object& target_name, const py::object& data, const py::object& metadata, const py::object& buffers, const py::kwargs& kwargs);
         xcomm(xeus::xcomm&& comm);
-        xcomm(xcomm&& comm) = default;
+        xcomm(xcomm&& comm);
         virtual ~xcomm();
 
         std::string comm_id() const;
@@ -35,23 +80,86 @@ namespace xpyt
 
         void close(const py::object& data, const py::object& metadata, const py::object& buffers);
         void send(const py::object& data, const py::object& metadata, const py::object& buffers);
-        void on_msg(const python_callback_type& callback);
+        void on_msg(const py::object& callback, bool raw, const std::string& encoding);
         void on_close(const python_callback_type& callback);
 
+        // Sends a large buffer as a sequence of chunk messages. At most window
+        // chunks are in flight, the next ones are sent when the frontend
+        // acknowledges the previous ones, so that other messages can be
+        // interleaved with the transfer. Strided buffers are sent from a
+        // C-contiguous copy.
+        std::string send_stream(const py::buffer& buffer,
+                                const py::object& data,
+                                const py::object& metadata,
+                                std::size_t chunk_size,
+                                std::size_t window,
+                                const py::object& on_complete);
+        void cancel_stream(const std::string& stream_id);
+        std::size_t pending_streams() const;
+
+        // Buffers larger than threshold are written to shared memory segments
+        // and only their handles are sent, in the "shm_buffers" metadata.
+        // The frontend releases them with a "shm_release" message.
+        void enable_shared_memory(std::size_t threshold);
+        void disable_shared_memory();
+
     private:
 
+        struct xchunked_transfer
+        {
+            std::unique_ptr<py::buffer_info> m_buffer;
+            nl::json m_metadata;
+            py::object m_on_complete;
+            std::size_t m_size;
+            std::size_t m_chunk_size;
+            std::size_t m_chunk_count;
+            std::size_t m_window;
+            std::size_t m_next_chunk;
+            std::size_t m_acked_chunks;
+        };
+
+        using transfer_map = std::map<std::string, xchunked_transfer>;
+
         xeus::xtarget* target(const py::object& target_name) const;
         xeus::xguid id(const py::kwargs& kwargs) const;
         cpp_callback_type cpp_callback(const python_callback_type& callback) const;
+        cpp_callback_type cpp_raw_callback(const python_raw_callback_type& callback, raw_encoding encoding) const;
+
+        void install_message_handler();
+        void handle_message(const xeus::xmessage& msg);
+        void handle_close(const xeus::xmessage& msg);
+        bool handle_internal_message(const nl::json& data);
+        bool handle_stream_message(const std::string& method, const nl::json& data);
+        void send_chunks(const std::string& stream_id, xchunked_transfer& transfer);
+
+        buffers_sequence to_shared_buffers(const py::object& buffers, nl::json& metadata, std::size_t shm_threshold);
+        void release_shared_buffers();
+
+        using callback_ptr = std::shared_ptr<const cpp_callback_type>;
+
+        callback_ptr make_callback(cpp_callback_type callback) const;
 
+        // The messages of the comm are handled on the shell thread while user
+        // threads may call its methods, the module does not rely on the GIL
+        // in free-threaded builds. m_mutex guards the members below, it is
+        // never held while calling Python code nor while acquiring the GIL.
+        // The callbacks are shared so that they are called outside the lock,
+        // copying the underlying Python functions would require the GIL.
         xeus::xcomm m_comm;
+        mutable std::mutex m_mutex;
+        callback_ptr m_msg_callback;
+        callback_ptr m_close_callback;
+        transfer_map m_transfers;
+        std::size_t m_shm_threshold = 0;
+        std::set<std::string> m_shm_segments;
+        bool m_handler_installed = false;
     };
 
     struct xcomm_manager
     {
         xcomm_manager() = default;
 
-        void register_target(const py::str& target_name, const py::object& callback);
+        void register_target(const py::str& target_name, const py::object& callback, bool raw, const std::string& encoding);
     };
 
     py::module get_comm_module();
@@ -0,0 +1,475 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11_json/pybind11_json.hpp"
+
+#include "pybind11/pybind11.h"
+#include "pybind11/eval.h"
+
+#include "xcompletion_worker.hpp"
+#include "xinternal_utils.hpp"
+
+#if XPYT_HAS_COMPLETION_WORKER
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+using namespace pybind11::literals;
+
+namespace xpyt
+{
+    namespace
+    {
+        // Builds the namespace summary sent to the worker. Only the names
+        // bound to a different object since the previous summary are
+        // described again. Signatures and docstrings are only computed for
+        // the objects that the worker cannot import, jedi infers the other
+        // ones in the worker when a request needs them.
+        constexpr const char* summary_source = R"(
+import inspect
+import types
+
+def _signature(obj):
+    try:
+        return str(inspect.signature(obj))
+    except (TypeError, ValueError):
+        return None
+
+def _doc(obj):
+    doc = inspect.getdoc(obj)
+    return doc[:4096] if doc else ''
+
+def _member(value):
+    if inspect.isroutine(value):
+        return {'kind': 'function', 'signature': _signature(value), 'doc': _doc(value)}
+    return {'kind': 'attribute'}
+
+def _importable(entry):
+    module, qualname = entry['module'], entry['qualname']
+    return module not in ('', '__main__') and qualname and '<' not in qualname
+
+def _entry(obj):
+    if isinstance(obj, types.ModuleType):
+        return {'kind': 'module', 'module': obj.__name__}
+
+    if inspect.isclass(obj):
+        kind, tp = 'class', obj
+    elif inspect.isroutine(obj):
+        kind, tp = 'function', obj
+    else:
+        kind, tp = 'instance', type(obj)
+
+    entry = {
+        'kind': kind,
+        'module': getattr(tp, '__module__', None) or '',
+        'qualname': getattr(tp, '__qualname__', None) or '',
+    }
+    if kind != 'instance' and not _importable(entry):
+        entry['signature'] = _signature(obj)
+        entry['doc'] = _doc(obj)
+    if kind == 'class' and entry['module'] == '__main__':
+        entry['members'] = {
+            name: _member(value) for name, value in vars(obj).items()
+            if not name.startswith('__')
+        }
+    return entry
+
+def summarize(ns, ids):
+    updated = {}
+    current = {}
+    for name, value in list(ns.items()):
+        if name == '__builtins__':
+            continue
+        key = (id(value), id(type(value)))
+        current[name] = key
+        if ids.get(name) != key:
+            try:
+                updated[name] = _entry(value)
+            except Exception:
+                updated[name] = {'kind': 'unknown'}
+    removed = [name for name in ids if name not in current]
+    return updated, removed, current
+)";
+
+        // Entry point of the worker process
+        constexpr const char* worker_source = R"(
+import json
+import keyword
+import sys
+
+import jedi
+
+def _valid_signature(signature):
+    if not signature:
+        return '(*args, **kwargs)'
+    try:
+        compile('def f' + signature + ': pass', '<stub>', 'exec')
+        return signature
+    except SyntaxError:
+        return '(*args, **kwargs)'
+
+def _is_name(name):
+    return name.isidentifier() and not keyword.iskeyword(name)
+
+def _reference(entry, alias, lines):
+    module, qualname = entry.get('module', ''), entry.get('qualname', '')
+    if module in ('', '__main__') or not qualname or '<' in qualname:
+        return None
+    if module == 'builtins':
+        return qualname
+    head, _, rest = qualname.partition('.')
+    lines.append('from {} import {} as {}'.format(module, head, alias))
+    return alias + ('.' + rest if rest else '')
+
+def make_stub(names):
+    lines = []
+    for index, (name, entry) in enumerate(sorted(names.items())):
+        if not _is_name(name):
+            continue
+        kind = entry.get('kind')
+        alias = '_xpyt_stub_{}'.format(index)
+        if kind == 'module':
+            lines.append('import {} as {}'.format(entry['module'], name))
+        elif kind in ('class', 'function'):
+            reference = _reference(entry, alias, lines)
+            if reference is not None:
+                lines.append('{} = {}'.format(name, reference))
+            elif kind == 'function':
+                lines.append('def {}{}:'.format(name, _valid_signature(entry.get('signature'))))
+                lines.append('    {!r}'.format(entry.get('doc', '')))
+            else:
+                lines.append('class {}:'.format(name))
+                lines.append('    {!r}'.format(entry.get('doc', '')))
+                for member, value in entry.get('members', {}).items():
+                    if not _is_name(member):
+                        continue
+                    if value['kind'] == 'function':
+                        lines.append('    def {}{}:'.format(member, _valid_signature(value.get('signature'))))
+                        lines.append('        {!r}'.format(value.get('doc', '')))
+                    else:
+                        lines.append('    {} = None'.format(member))
+        elif kind == 'instance':
+            reference = _reference(entry, alias, lines)
+            if reference is None and entry.get('module') == '__main__' and _is_name(entry.get('qualname', '')):
+                reference = entry['qualname']
+            if reference is not None:
+                lines.append('{}: {} = ...'.format(name, reference))
+            else:
+                lines.append('{} = None'.format(name))
+        else:
+            lines.append('{} = None'.format(name))
+    return '\n'.join(lines) + '\n'
+
+def _script(stub, code, cursor_pos):
+    before = code[:cursor_pos].split('\n')
+    line = stub.count('\n') + len(before)
+    return jedi.Script(stub + code), line, len(before[-1])
+
+def complete(stub, message):
+    script, line, column = _script(stub, message['code'], message['cursor_pos'])
+    completions = script.complete(line, column)
+    cursor_start = message['cursor_pos']
+    if completions:
+        cursor_start -= len(completions[0].name_with_symbols) - len(completions[0].complete)
+    return {
+        'matches': [c.name_with_symbols for c in completions],
+        'cursor_start': cursor_start,
+        'cursor_end': message['cursor_pos'],
+        'metadata': {},
+        'status': 'ok',
+    }
+
+def inspect(stub, message):
+    script, line, column = _script(stub, message['code'], message['cursor_pos'])
+    definitions = script.get_signatures(line, column) or script.infer(line, column)
+    if not definitions:
+        return {'data': {}, 'metadata': {}, 'found': False, 'status': 'ok'}
+    definition = definitions[0]
+    signatures = definition.get_signatures()
+    if signatures:
+        header = 'Signature: ' + signatures[0].to_string()
+    else:
+        header = 'Name: ' + definition.name
+    text = '{}\nType: {}\nDocstring: {}'.format(header, definition.type, definition.docstring(raw=True))
+    return {'data': {'text/plain': text}, 'metadata': {}, 'found': True, 'status': 'ok'}
+
+def main():
+    handlers = {'complete': complete, 'inspect': inspect}
+    names = {}
+    stub = '\n'
+    dirty = False
+    for line in sys.stdin:
+        message = json.loads(line)
+        if message['op'] == 'update':
+            names.update(message['updated'])
+            for name in message['removed']:
+                names.pop(name, None)
+            dirty = True
+            continue
+
+        if dirty:
+            stub = make_stub(names)
+            dirty = False
+        try:
+            reply = handlers[message['op']](stub, message)
+        except Exception as e:
+            reply = {'status': 'error', 'ename': type(e).__name__, 'evalue': str(e), 'traceback': []}
+        reply['id'] = message['id']
+        sys.stdout.write(json.dumps(reply) + '\n')
+        sys.stdout.flush()
+
+main()
+)";
+
+        py::object make_summary_function()
+        {
+            py::module summary_module = create_module("completion_worker_summary");
+            py::exec(summary_source, summary_module.attr("__dict__"));
+            return summary_module.attr("summarize");
+        }
+
+        nl::json busy_reply()
+        {
+            return {
+                {"status", "error"},
+                {"ename", "KernelBusy"},
+                {"evalue", "The completion worker is not available"},
+                {"traceback", nl::json::array()}
+            };
+        }
+    }
+
+    bool completion_worker_enabled()
+    {
+#if XPYT_HAS_COMPLETION_WORKER
+        const char* value = std::getenv("XPYTHON_COMPLETION_WORKER");
+        return value != nullptr && std::string(value) != "" && std::string(value) != "0";
+#else
+        return false;
+#endif
+    }
+
+    /*************************************
+     * xcompletion_worker implementation *
+     *************************************/
+
+    xcompletion_worker::xcompletion_worker(std::chrono::milliseconds timeout)
+        : m_timeout(timeout)
+        , m_in_fd(-1)
+        , m_out_fd(-1)
+        , m_next_id(0)
+        , m_alive(false)
+    {
+#if XPYT_HAS_COMPLETION_WORKER
+        py::module subprocess = py::module::import("subprocess");
+        py::module sys = py::module::import("sys");
+        m_process = subprocess.attr("Popen")(
+            py::make_tuple(sys.attr("executable"), "-c", worker_source),
+            "stdin"_a = subprocess.attr("PIPE"),
+            "stdout"_a = subprocess.attr("PIPE"),
+            "bufsize"_a = 0
+        );
+        m_in_fd = m_process.attr("stdin").attr("fileno")().cast<int>();
+        m_out_fd = m_process.attr("stdout").attr("fileno")().cast<int>();
+        // Writes wait for the worker with the same timeout as reads
+        ::fcntl(m_in_fd, F_SETFL, ::fcntl(m_in_fd, F_GETFL) | O_NONBLOCK);
+        m_summarize = make_summary_function();
+        m_alive = true;
+#else
+        throw std::runtime_error("The completion worker is not supported on this platform");
+#endif
+    }
+
+    xcompletion_worker::~xcompletion_worker()
+    {
+        if (m_process)
+        {
+            try
+            {
+                // Closing stdin ends the read loop of the worker
+                m_process.attr("stdin").attr("close")();
+                m_process.attr("wait")("timeout"_a = 1);
+            }
+            catch (py::error_already_set&)
+            {
+                try
+                {
+                    m_process.attr("kill")();
+                }
+                catch (py::error_already_set&)
+                {
+                }
+            }
+        }
+    }
+
+    bool xcompletion_worker::alive() const
+    {
+        return m_alive;
+    }
+
+    void xcompletion_worker::update_namespace(const py::dict& ns)
+    {
+        if (!m_alive)
+        {
+            return;
+        }
+
+        py::tuple res = m_summarize(ns, m_ids);
+        py::dict updated = res[0];
+        py::list removed = res[1];
+        m_ids = res[2];
+        if (py::len(updated) == 0 && py::len(removed) == 0)
+        {
+            return;
+        }
+
+        nl::json message;
+        message["op"] = "update";
+        message["updated"] = updated;
+        message["removed"] = removed;
+        write_line(message.dump(-1, ' ', false, nl::json::error_handler_t::replace));
+    }
+
+    nl::json xcompletion_worker::complete(const std::string& code, int cursor_pos)
+    {
+        return request({{"op", "complete"}, {"code", code}, {"cursor_pos", cursor_pos}});
+    }
+
+    nl::json xcompletion_worker::inspect(const std::string& code, int cursor_pos, int detail_level)
+    {
+        return request({{"op", "inspect"}, {"code", code}, {"cursor_pos", cursor_pos}, {"detail_level", detail_level}});
+    }
+
+    nl::json xcompletion_worker::request(nl::json message)
+    {
+        int id = m_next_id++;
+        message["id"] = id;
+
+        nl::json reply;
+        if (!m_alive || !write_line(message.dump()) || !read_reply(id, reply))
+        {
+            return busy_reply();
+        }
+        reply.erase("id");
+        return reply;
+    }
+
+#if XPYT_HAS_COMPLETION_WORKER
+    bool xcompletion_worker::write_line(const std::string& line)
+    {
+        std::string data = line + '\n';
+        py::gil_scoped_release release;
+        auto deadline = std::chrono::steady_clock::now() + m_timeout;
+        std::size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t res = ::write(m_in_fd, data.data() + written, data.size() - written);
+            if (res >= 0)
+            {
+                written += static_cast<std::size_t>(res);
+                continue;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // A worker that does not read its input anymore is considered
+            // dead, a partial line cannot be completed later.
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || remaining.count() <= 0)
+            {
+                m_alive = false;
+                return false;
+            }
+
+            pollfd item = { m_in_fd, POLLOUT, 0 };
+            res = ::poll(&item, 1, static_cast<int>(remaining.count()));
+            if (res < 0 && errno != EINTR)
+            {
+                m_alive = false;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool xcompletion_worker::read_reply(int id, nl::json& reply)
+    {
+        py::gil_scoped_release release;
+        auto deadline = std::chrono::steady_clock::now() + m_timeout;
+        while (true)
+        {
+            // Replies to requests that timed out are skipped
+            std::size_t end = m_read_buffer.find('\n');
+            while (end != std::string::npos)
+            {
+                nl::json candidate = nl::json::parse(m_read_buffer.substr(0, end), nullptr, false);
+                m_read_buffer.erase(0, end + 1);
+                if (!candidate.is_discarded() && candidate.value("id", -1) == id)
+                {
+                    reply = std::move(candidate);
+                    return true;
+                }
+                end = m_read_buffer.find('\n');
+            }
+
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                return false;
+            }
+
+            pollfd item = { m_out_fd, POLLIN, 0 };
+            int res = ::poll(&item, 1, static_cast<int>(remaining.count()));
+            if (res < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (res <= 0)
+            {
+                return false;
+            }
+
+            char buffer[4096];
+            ssize_t size = ::read(m_out_fd, buffer, sizeof(buffer));
+            if (size <= 0)
+            {
+                m_alive = false;
+                return false;
+            }
+            m_read_buffer.append(buffer, static_cast<std::size_t>(size));
+        }
+    }
+#else
+    bool xcompletion_worker::write_line(const std::string&)
+    {
+        return false;
+    }
+
+    bool xcompletion_worker::read_reply(int, nl::json&)
+    {
+        return false;
+    }
+#endif
+}
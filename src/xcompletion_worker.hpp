@@ -0,0 +1,113 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_COMPLETION_WORKER_HPP
+#define XPYT_COMPLETION_WORKER_HPP
+
+#include <chrono>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#if !defined(XPYT_EMSCRIPTEN_WASM_BUILD) && (defined(__unix__) || defined(__APPLE__))
+    #define XPYT_HAS_COMPLETION_WORKER 1
+#else
+    #define XPYT_HAS_COMPLETION_WORKER 0
+#endif
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    // True when the XPYTHON_COMPLETION_WORKER environment variable is set
+    // to a value other than 0 on a platform supporting the worker.
+    bool completion_worker_enabled();
+
+    // Marks the interpreter as busy for the lifetime of the guard
+    class xbusy_guard
+    {
+    public:
+
+        explicit xbusy_guard(bool& busy)
+            : m_busy(busy)
+        {
+            m_busy = true;
+        }
+
+        ~xbusy_guard()
+        {
+            m_busy = false;
+        }
+
+        xbusy_guard(const xbusy_guard&) = delete;
+        xbusy_guard& operator=(const xbusy_guard&) = delete;
+
+    private:
+
+        bool& m_busy;
+    };
+
+    /**********************************
+     * xcompletion_worker declaration *
+     **********************************/
+
+    // Python subprocess answering complete and inspect requests while the
+    // interpreter is busy running a cell. The worker holds a read-only
+    // summary of the user namespace (names, types, and the signatures and
+    // docstrings of the objects it cannot import) that is synchronized
+    // incrementally after each execution, and runs jedi on a stub module
+    // generated from this summary.
+    //
+    // Messages are exchanged as JSON lines over the standard streams of the
+    // worker. The GIL is released while waiting for the worker. Reads and
+    // writes give up after the timeout, a worker that does not read its
+    // input in time is no longer used.
+    class xcompletion_worker
+    {
+    public:
+
+        // Starts the worker, must be called with the GIL held
+        explicit xcompletion_worker(std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+        ~xcompletion_worker();
+
+        xcompletion_worker(const xcompletion_worker&) = delete;
+        xcompletion_worker& operator=(const xcompletion_worker&) = delete;
+
+        bool alive() const;
+
+        // Sends the names of ns that changed since the last update
+        void update_namespace(const py::dict& ns);
+
+        // Replies in the format of complete_reply and inspect_reply
+        nl::json complete(const std::string& code, int cursor_pos);
+        nl::json inspect(const std::string& code, int cursor_pos, int detail_level);
+
+    private:
+
+        nl::json request(nl::json message);
+        bool write_line(const std::string& line);
+        bool read_reply(int id, nl::json& reply);
+
+        std::chrono::milliseconds m_timeout;
+        py::object m_process;
+        py::object m_summarize;
+        py::dict m_ids;
+        int m_in_fd;
+        int m_out_fd;
+        int m_next_id;
+        bool m_alive;
+        std::string m_read_buffer;
+    };
+}
+
+#endif
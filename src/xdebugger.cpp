@@ -11,6 +11,7 @@
 #include <cctype>
 #include <cstdlib>
 #include <fstream>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <thread>
@@ -33,6 +34,7 @@
 #include "xeus-python/xutils.hpp"
 #include "xdebugpy_client.hpp"
 #include "xinternal_utils.hpp"
+#include "xsampler.hpp"
 
 namespace nl = nlohmann;
 namespace py = pybind11;
@@ -66,6 +68,7 @@ namespace xpyt
         register_request_handler("attach", std::bind(&debugger::attach_request, this, _1), true);
         register_request_handler("configurationDone", std::bind(&debugger::configuration_done_request, this, _1), true);
         register_request_handler("copyToGlobals", std::bind(&debugger::copy_to_globals_request, this, _1), true);
+        register_request_handler("sampleProfile", std::bind(&debugger::sample_profile_request, this, _1), false);
     }
 
     debugger::~debugger()
@@ -227,6 +230,32 @@ namespace xpyt
         return forward_message(request);
     }
 
+    nl::json debugger::sample_profile_request(const nl::json& message)
+    {
+        nl::json reply = {
+            {"type", "response"},
+            {"request_seq", message["seq"]},
+            {"success", false},
+            {"command", message["command"]}
+        };
+
+        // The control channel is blocked while sampling, the duration is
+        // bounded so that the kernel can still be shut down
+        nl::json arguments = message.value("arguments", nl::json::object());
+        double duration = arguments.value("duration", 5.0);
+        double rate = arguments.value("rate", 100.0);
+        bool native = arguments.value("native", false);
+        if (duration <= 0. || duration > 60. || rate <= 0. || rate > 1000.)
+        {
+            reply["body"] = "The duration must be in ]0, 60] seconds and the rate in ]0, 1000] Hz.";
+            return reply;
+        }
+
+        reply["body"] = sample_main_thread(std::chrono::duration<double>(duration), rate, native);
+        reply["success"] = true;
+        return reply;
+    }
+
     nl::json debugger::variables_request_impl(const nl::json& message)
     {
         if (base_type::get_stopped_threads().empty())
@@ -25,8 +25,11 @@
 
 #include "xeus-python/xutils.hpp"
 
+#include "xbatch.hpp"
 #include "xdisplay.hpp"
 #include "xinternal_utils.hpp"
+#include "xprofiler.hpp"
+#include "xtimer.hpp"
 
 #ifdef __GNUC__
     #pragma GCC diagnostic push
@@ -45,7 +48,7 @@ namespace xpyt_ipython
 
     void xpublish_display_data(const py::object& data, const py::object& metadata, const py::object& transient, bool update)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         // Make sure transient is not None
         py::object transient_ = transient;
@@ -54,13 +57,14 @@ namespace xpyt_ipython
             transient_ = py::dict();
         }
 
+        xpyt::xtimer::scope timing(xpyt::get_execution_timer(), "publish");
         if (update)
         {
-            interp.update_display_data(data, metadata, transient_);
+            interp.update_display_data(data, xpyt::add_batch_metadata(metadata), transient_);
         }
         else
         {
-            interp.display_data(data, metadata, transient_);
+            interp.display_data(data, xpyt::add_batch_metadata(metadata), transient_);
         }
     }
 
@@ -70,12 +74,13 @@ namespace xpyt_ipython
 
     void xpublish_execution_result(const py::int_& execution_count, const py::object& data, const py::object& metadata)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         nl::json cpp_data = data;
         if (cpp_data.size() != 0)
         {
-            interp.publish_execution_result(execution_count, std::move(cpp_data), metadata);
+            xpyt::xtimer::scope timing(xpyt::get_execution_timer(), "publish");
+            interp.publish_execution_result(execution_count, std::move(cpp_data), xpyt::add_batch_metadata(metadata));
         }
     }
 
@@ -85,7 +90,7 @@ namespace xpyt_ipython
 
     void xclear(bool wait = false)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         interp.clear_output(wait);
     }
@@ -243,7 +248,7 @@ namespace xpyt_raw
 
     void xdisplayhook::operator()(const py::object& obj, bool raw = false) const
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         if (!obj.is_none())
         {
@@ -266,7 +271,8 @@ namespace xpyt_raw
                 pub_metadata = repr[1];
             }
 
-            interp.publish_execution_result(m_execution_count, pub_data, pub_metadata);
+            xpyt::xtimer::scope timing(xpyt::get_execution_timer(), "publish");
+            interp.publish_execution_result(m_execution_count, pub_data, xpyt::add_batch_metadata(pub_metadata));
         }
     }
 
@@ -283,7 +289,7 @@ namespace xpyt_raw
         bool update,
         bool raw)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         for (std::size_t i = 0; i < objs.size(); ++i)
         {
@@ -316,13 +322,14 @@ namespace xpyt_raw
                 {
                     cpp_transient["display_id"] = display_id;
                 }
+                xpyt::xtimer::scope timing(xpyt::get_execution_timer(), "publish");
                 if (update)
                 {
-                    interp.update_display_data(pub_data, pub_metadata, std::move(cpp_transient));
+                    interp.update_display_data(pub_data, xpyt::add_batch_metadata(pub_metadata), std::move(cpp_transient));
                 }
                 else
                 {
-                    interp.display_data(pub_data, pub_metadata, std::move(cpp_transient));
+                    interp.display_data(pub_data, xpyt::add_batch_metadata(pub_metadata), std::move(cpp_transient));
                 }
             }
         }
@@ -354,9 +361,10 @@ namespace xpyt_raw
 
     void xpublish_display_data(const py::object& data, const py::object& metadata, const py::str& /*source*/, const py::object& transient)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
-        interp.display_data(data, metadata, transient);
+        xpyt::xtimer::scope timing(xpyt::get_execution_timer(), "publish");
+        interp.display_data(data, xpyt::add_batch_metadata(metadata), transient);
     }
 
     void xdisplay_mimetype(const std::string& mimetype, py::args objs, py::kwargs kw)
@@ -432,7 +440,7 @@ namespace xpyt_raw
 
     void xclear(bool wait = false)
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
         interp.clear_output(wait);
     }
 
@@ -1111,7 +1119,7 @@ namespace xpyt_raw
 
     void xprogressbar::display(bool update) const
     {
-        auto& interp = xeus::get_interpreter();
+        auto& interp = get_kernel_interpreter();
 
         nl::json cpp_transient;
         cpp_transient["display_id"] = m_id;
@@ -1182,6 +1190,14 @@ namespace xpyt_raw
         display_module.def("display_javascript", xdisplay_javascript);
         display_module.def("display_pdf", xdisplay_pdf);
 
+        // Profiling of the next cell, the raw counterpart of %%prun
+        display_module.def("profile_next_cell",
+            [](const std::string& sort, std::size_t limit) { xpyt::get_profiler().request(sort, limit); },
+            py::arg("sort") = "cumtime",
+            py::arg("limit") = 30);
+
+        display_module.def("last_profile", []() { return xpyt::get_profiler().last_profile(); });
+
         py::class_<xdisplay_object>(display_module, "DisplayObject")
             .def(
                 py::init<const py::object&, const py::object&, const py::object&, const py::object&>(),
@@ -1267,16 +1283,9 @@ namespace xpyt
 {
     py::module get_display_module(bool raw_mode /*false*/)
     {
-        static py::module display_module;
-        if (raw_mode)
-        {
-            display_module = xpyt_raw::get_display_module_impl();
-        }
-        else
-        {
-            display_module = xpyt_ipython::get_display_module_impl();
-        }
-        return display_module;
+        static xinterpreter_singleton raw_display_module("raw_display", xpyt_raw::get_display_module_impl);
+        static xinterpreter_singleton display_module("display", xpyt_ipython::get_display_module_impl);
+        return py::reinterpret_borrow<py::module>(raw_mode ? raw_display_module.get() : display_module.get());
     }
 }
 
@@ -0,0 +1,300 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+
+#include "xfork_server.hpp"
+
+#if XPYT_HAS_FORK_SERVER
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        std::string trim(const std::string& str)
+        {
+            std::size_t first = str.find_first_not_of(" \t\r\n");
+            if (first == std::string::npos)
+            {
+                return "";
+            }
+            std::size_t last = str.find_last_not_of(" \t\r\n");
+            return str.substr(first, last - first + 1);
+        }
+
+        std::vector<std::string> preloaded_modules(bool raw_mode)
+        {
+            const char* env = std::getenv("XPYTHON_FORK_SERVER_PRELOAD");
+            if (env == nullptr)
+            {
+                if (raw_mode)
+                {
+                    return {"jedi", "pygments"};
+                }
+                return {"IPython", "xeus_python_shell", "jedi", "pygments"};
+            }
+
+            std::vector<std::string> res;
+            std::stringstream modules(env);
+            std::string name;
+            while (std::getline(modules, name, ','))
+            {
+                name = trim(name);
+                if (!name.empty())
+                {
+                    res.push_back(name);
+                }
+            }
+            return res;
+        }
+
+#if XPYT_HAS_FORK_SERVER
+        // Connection files are read from the FIFO, which must not be
+        // writable by other users. An existing path is only used when it is
+        // a FIFO owned by the current user, not a symbolic link. The checks
+        // are made on the opened file so that the path cannot be replaced
+        // in between.
+        class fifo_reader
+        {
+        public:
+
+            // Opening blocks until a writer opens the FIFO
+            explicit fifo_reader(const std::string& fifo_path)
+                : m_fd(open(fifo_path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC))
+            {
+                if (m_fd < 0)
+                {
+                    throw std::runtime_error("Could not open FIFO " + fifo_path + ": " + std::strerror(errno));
+                }
+
+                struct stat info;
+                std::string error;
+                if (fstat(m_fd, &info) != 0)
+                {
+                    error = "Could not stat FIFO " + fifo_path + ": " + std::strerror(errno);
+                }
+                else if (!S_ISFIFO(info.st_mode))
+                {
+                    error = fifo_path + " is not a FIFO";
+                }
+                else if (info.st_uid != geteuid())
+                {
+                    error = "FIFO " + fifo_path + " is not owned by the current user";
+                }
+                else if ((info.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+                {
+                    error = "FIFO " + fifo_path + " is writable by other users";
+                }
+
+                if (!error.empty())
+                {
+                    close(m_fd);
+                    throw std::runtime_error(error);
+                }
+            }
+
+            ~fifo_reader()
+            {
+                close(m_fd);
+            }
+
+            fifo_reader(const fifo_reader&) = delete;
+            fifo_reader& operator=(const fifo_reader&) = delete;
+
+            // Returns false once the last writer has closed the FIFO and
+            // every line has been read.
+            bool getline(std::string& line)
+            {
+                std::size_t end = m_buffer.find('\n');
+                while (end == std::string::npos && !m_eof)
+                {
+                    char chunk[4096];
+                    ssize_t count = read(m_fd, chunk, sizeof(chunk));
+                    if (count < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        throw std::runtime_error(std::string("Could not read FIFO: ") + std::strerror(errno));
+                    }
+                    m_eof = count == 0;
+                    m_buffer.append(chunk, static_cast<std::size_t>(count));
+                    end = m_buffer.find('\n');
+                }
+
+                if (end == std::string::npos)
+                {
+                    line = std::move(m_buffer);
+                    m_buffer.clear();
+                    return !line.empty();
+                }
+                line = m_buffer.substr(0, end);
+                m_buffer.erase(0, end + 1);
+                return true;
+            }
+
+        private:
+
+            int m_fd;
+            std::string m_buffer;
+            bool m_eof = false;
+        };
+
+        // The PID of a forked kernel is written next to its connection file.
+        // The file is renamed into place so that it is never read partially.
+        void write_pid_file(const std::string& connection_filename, pid_t pid)
+        {
+            std::string pid_filename = connection_filename + ".pid";
+            std::string tmp_filename = pid_filename + ".tmp";
+            {
+                std::ofstream out(tmp_filename);
+                out << pid << std::endl;
+                if (!out)
+                {
+                    std::clog << "Could not write " << tmp_filename << std::endl;
+                    return;
+                }
+            }
+            if (std::rename(tmp_filename.c_str(), pid_filename.c_str()) != 0)
+            {
+                std::clog << "Could not write " << pid_filename << ": " << std::strerror(errno) << std::endl;
+            }
+        }
+#endif
+    }
+
+    std::string extract_fifo_option(const std::string& option, int& argc, char* argv[])
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            if (std::string(argv[i]) == option)
+            {
+                if (i + 1 >= argc)
+                {
+                    throw std::runtime_error(option + " expects the path of a FIFO");
+                }
+
+                std::string res = argv[i + 1];
+                for (int j = i; j < argc - 2; ++j)
+                {
+                    argv[j] = argv[j + 2];
+                }
+                argc -= 2;
+                return res;
+            }
+        }
+        return "";
+    }
+
+#if XPYT_HAS_FORK_SERVER
+    void read_connection_files(const std::string& fifo_path,
+                               const std::function<bool(const std::string&)>& callback)
+    {
+        if (mkfifo(fifo_path.c_str(), S_IRUSR | S_IWUSR) != 0 && errno != EEXIST)
+        {
+            throw std::runtime_error("Could not create FIFO " + fifo_path + ": " + std::strerror(errno));
+        }
+
+        while (true)
+        {
+            // Reading stops when the last writer closes the FIFO
+            fifo_reader fifo(fifo_path);
+
+            std::string line;
+            while (fifo.getline(line))
+            {
+                std::string connection_filename = trim(line);
+                if (!connection_filename.empty() && !callback(connection_filename))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    std::string run_fork_server(const std::string& fifo_path, bool raw_mode)
+    {
+        for (const std::string& name : preloaded_modules(raw_mode))
+        {
+            try
+            {
+                py::module::import(name.c_str());
+            }
+            catch (py::error_already_set& e)
+            {
+                std::clog << "Could not preload " << name << ": " << e.what() << std::endl;
+            }
+        }
+
+        // Forked kernels are reaped automatically
+        signal(SIGCHLD, SIG_IGN);
+        std::clog << "Fork server waiting for connection files on " << fifo_path << std::endl;
+
+        std::string res;
+        read_connection_files(fifo_path, [&res](const std::string& connection_filename)
+        {
+            PyOS_BeforeFork();
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                PyOS_AfterFork_Child();
+                // Subprocesses started by the kernel must be waited for
+                signal(SIGCHLD, SIG_DFL);
+                res = connection_filename;
+                return false;
+            }
+
+            PyOS_AfterFork_Parent();
+            if (pid < 0)
+            {
+                std::clog << "Could not fork kernel for " << connection_filename << ": " << std::strerror(errno) << std::endl;
+            }
+            else
+            {
+                std::clog << "Forked kernel " << pid << " for " << connection_filename << std::endl;
+                write_pid_file(connection_filename, pid);
+            }
+            return true;
+        });
+        return res;
+    }
+#else
+    void read_connection_files(const std::string&, const std::function<bool(const std::string&)>&)
+    {
+        throw std::runtime_error("FIFOs are not supported on this platform");
+    }
+
+    std::string run_fork_server(const std::string&, bool)
+    {
+        throw std::runtime_error("The fork server is not supported on this platform");
+    }
+#endif
+}
@@ -0,0 +1,51 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_FORK_SERVER_HPP
+#define XPYT_FORK_SERVER_HPP
+
+#include <functional>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define XPYT_HAS_FORK_SERVER 1
+#else
+    #define XPYT_HAS_FORK_SERVER 0
+#endif
+
+namespace xpyt
+{
+    // Returns the FIFO path given with the option (--fork-server or
+    // --kernel-host), or an empty string if the option is absent. The option
+    // and its value are removed from argv.
+    std::string extract_fifo_option(const std::string& option, int& argc, char* argv[]);
+
+    // Calls callback with every connection file path written to the FIFO,
+    // one per line, creating the FIFO if needed. An existing FIFO must be
+    // owned by the current user and not writable by other users. Returns
+    // when the callback returns false.
+    void read_connection_files(const std::string& fifo_path,
+                               const std::function<bool(const std::string&)>& callback);
+
+    // Runs a fork server: the kernel modules are imported once, then a kernel
+    // process is forked for every connection file path written to the FIFO,
+    // one per line. The PID of the kernel is written to the connection file
+    // path suffixed with ".pid". The modules to import are read from the
+    // comma-separated XPYTHON_FORK_SERVER_PRELOAD environment variable when
+    // it is set.
+    //
+    // This function only returns in the forked processes, with the connection
+    // file of the kernel to start. The ZMQ context and the sockets must be
+    // created after it returns. Must be called with the GIL held, before any
+    // other thread is started.
+    std::string run_fork_server(const std::string& fifo_path, bool raw_mode);
+}
+
+#endif
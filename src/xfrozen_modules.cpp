@@ -0,0 +1,36 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <vector>
+
+#include "pybind11/pybind11.h"
+
+#include "xfrozen_modules.hpp"
+
+namespace xpyt
+{
+    void register_frozen_modules()
+    {
+        // The table must outlive the interpreter
+        static std::vector<struct _frozen> modules;
+
+        for (const struct _frozen* it = PyImport_FrozenModules; it != nullptr && it->name != nullptr; ++it)
+        {
+            modules.push_back(*it);
+        }
+        for (const struct _frozen* it = get_frozen_modules(); it->name != nullptr; ++it)
+        {
+            modules.push_back(*it);
+        }
+        modules.push_back(_frozen{});
+
+        PyImport_FrozenModules = modules.data();
+    }
+}
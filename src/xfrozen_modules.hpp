@@ -0,0 +1,30 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_FROZEN_MODULES_HPP
+#define XPYT_FROZEN_MODULES_HPP
+
+struct _frozen;
+
+namespace xpyt
+{
+    // Table of the kernel modules frozen at build time, terminated by an
+    // entry with a null name. Defined in the file generated by
+    // scripts/freeze_modules.py.
+    const struct _frozen* get_frozen_modules();
+
+    // Appends the frozen kernel modules to PyImport_FrozenModules. The frozen
+    // importer is queried before the path based finder, these modules are
+    // loaded without searching sys.path. Must be called before the Python
+    // interpreter is initialized.
+    void register_frozen_modules();
+}
+
+#endif
@@ -12,26 +12,46 @@
 #include <string>
 
 #include "xeus/xinterpreter.hpp"
-#include "xeus/xinput.hpp"
 
 #include "pybind11/functional.h"
 #include "pybind11/pybind11.h"
 
 #include "xinput.hpp"
+#include "xinternal_utils.hpp"
+#include "xsampler.hpp"
 #include "xeus-python/xutils.hpp"
 
 namespace py = pybind11;
 
 namespace xpyt
 {
+    namespace
+    {
+        // Same as xeus::blocking_input_request, sent by the kernel of the
+        // current Python interpreter rather than by xeus::get_interpreter()
+        std::string blocking_input_request(const std::string& prompt, bool password)
+        {
+            xeus::xinterpreter& interpreter = get_kernel_interpreter();
+
+            std::string value;
+            // The stdin socket is read by xeus, which does not retry on EINTR
+            xnative_sampling_pause sampling_pause;
+            interpreter.register_input_handler([&value](const std::string& v) { value = v; });
+            interpreter.input_request(prompt, password);
+            interpreter.register_input_handler(nullptr);
+
+            return value;
+        }
+    }
+
     std::string cpp_input(const std::string& prompt)
     {
-        return xeus::blocking_input_request(prompt, false);
+        return blocking_input_request(prompt, false);
     }
 
     std::string cpp_getpass(const std::string& prompt)
     {
-        return xeus::blocking_input_request(prompt, true);
+        return blocking_input_request(prompt, true);
     }
 
     void notimplemented(const std::string&)
@@ -8,6 +8,11 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
@@ -132,4 +137,496 @@ namespace xpyt
         py::object inter = static_inspect(code);
         return formatted_docstring_impl(inter);
     }
+
+    /************************************
+     * namespace version implementation *
+     ************************************/
+
+    namespace
+    {
+        std::atomic<std::size_t> namespace_version{0};
+
+#if PY_VERSION_HEX >= 0x030C0000
+        int namespace_watcher(PyDict_WatchEvent, PyObject*, PyObject*, PyObject*)
+        {
+            ++namespace_version;
+            return 0;
+        }
+#endif
+    }
+
+    std::size_t get_namespace_version()
+    {
+        return namespace_version.load();
+    }
+
+    void bump_namespace_version()
+    {
+        ++namespace_version;
+    }
+
+    bool watch_namespace(const py::dict& ns)
+    {
+#if PY_VERSION_HEX >= 0x030C0000
+        static int watcher_id = PyDict_AddWatcher(&namespace_watcher);
+        if (watcher_id < 0)
+        {
+            PyErr_Clear();
+            return false;
+        }
+        if (PyDict_Watch(watcher_id, ns.ptr()) != 0)
+        {
+            PyErr_Clear();
+            return false;
+        }
+        return true;
+#else
+        (void)ns;
+        return false;
+#endif
+    }
+
+    py::object resolve_dotted_name(const std::string& name, const py::dict& ns)
+    {
+        std::vector<std::string> parts;
+        std::size_t start = 0;
+        while (true)
+        {
+            std::size_t end = name.find('.', start);
+            parts.push_back(name.substr(start, end - start));
+            if (parts.back().empty())
+            {
+                return py::object();
+            }
+            if (end == std::string::npos)
+            {
+                break;
+            }
+            start = end + 1;
+        }
+
+        try
+        {
+            py::str head(parts[0]);
+            py::object obj;
+            if (ns.contains(head))
+            {
+                obj = ns[head];
+            }
+            else
+            {
+                obj = py::getattr(py::module::import("builtins"), head, py::handle());
+            }
+
+            // A single lookup per attribute, properties are only evaluated once
+            for (std::size_t i = 1; i < parts.size() && obj; ++i)
+            {
+                obj = py::getattr(obj, parts[i].c_str(), py::handle());
+            }
+            return obj;
+        }
+        catch (py::error_already_set&)
+        {
+            return py::object();
+        }
+    }
+
+    /*********************************
+     * xinspect_cache implementation *
+     *********************************/
+
+    xinspect_cache::xinspect_cache(std::size_t capacity)
+        : m_capacity(capacity)
+        , m_version(get_namespace_version())
+    {
+    }
+
+    bool xinspect_cache::find(const std::string& key, const py::handle& obj, nl::json& data)
+    {
+        check_namespace_version();
+
+        auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                               [&key](const auto& e) { return e.first == key; });
+        if (it == m_entries.end() || !it->second.m_object().is(obj))
+        {
+            return false;
+        }
+
+        m_entries.splice(m_entries.begin(), m_entries, it);
+        data = it->second.m_data;
+        return true;
+    }
+
+    void xinspect_cache::insert(const std::string& key, const py::handle& obj, const nl::json& data)
+    {
+        check_namespace_version();
+
+        auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                               [&key](const auto& e) { return e.first == key; });
+        if (it != m_entries.end())
+        {
+            m_entries.erase(it);
+        }
+
+        // Objects that do not support weak references are not cached
+        PyObject* ref = PyWeakref_NewRef(obj.ptr(), nullptr);
+        if (ref == nullptr)
+        {
+            PyErr_Clear();
+            return;
+        }
+        m_entries.emplace_front(key, entry{py::reinterpret_steal<py::weakref>(ref), data});
+        if (m_entries.size() > m_capacity)
+        {
+            m_entries.pop_back();
+        }
+    }
+
+    void xinspect_cache::check_namespace_version()
+    {
+        std::size_t version = get_namespace_version();
+        if (version != m_version)
+        {
+            m_entries.clear();
+            m_version = version;
+        }
+    }
+
+    /*************************************
+     * xcompletion_engine implementation *
+     *************************************/
+
+    namespace
+    {
+        using deadline_clock = std::chrono::steady_clock;
+
+        struct xdeadline_state
+        {
+            deadline_clock::time_point m_deadline;
+            std::size_t m_calls = 0;
+            bool m_expired = false;
+        };
+
+        int deadline_profile(PyObject* obj, PyFrameObject*, int what, PyObject*)
+        {
+            if (what != PyTrace_CALL)
+            {
+                return 0;
+            }
+
+            auto* state = static_cast<xdeadline_state*>(PyCapsule_GetPointer(obj, nullptr));
+            // Reading the clock on every call would slow down the inference
+            if (!state->m_expired && (++(state->m_calls) & 0xFF) == 0)
+            {
+                state->m_expired = deadline_clock::now() > state->m_deadline;
+            }
+
+            // The exception is raised again on subsequent calls in case
+            // jedi swallows it.
+            if (state->m_expired)
+            {
+                PyErr_SetString(PyExc_TimeoutError, "completion deadline exceeded");
+                return -1;
+            }
+            return 0;
+        }
+
+        // Scope guard interrupting the Python code run in its scope once the
+        // deadline has expired. It relies on a C profile function, so that
+        // nothing has to run on another thread. It is a no-op when a profiler
+        // is already installed.
+        class xdeadline_guard
+        {
+        public:
+
+            explicit xdeadline_guard(std::chrono::milliseconds timeout)
+                : m_active(false)
+            {
+                if (timeout.count() > 0 && py::module::import("sys").attr("getprofile")().is_none())
+                {
+                    m_state.m_deadline = deadline_clock::now() + timeout;
+                    m_capsule = py::capsule(&m_state);
+                    PyEval_SetProfile(&deadline_profile, m_capsule.ptr());
+                    m_active = true;
+                }
+            }
+
+            ~xdeadline_guard()
+            {
+                if (m_active)
+                {
+                    PyEval_SetProfile(nullptr, nullptr);
+                }
+            }
+
+            xdeadline_guard(const xdeadline_guard&) = delete;
+            xdeadline_guard& operator=(const xdeadline_guard&) = delete;
+
+            bool expired() const
+            {
+                return m_state.m_expired;
+            }
+
+        private:
+
+            xdeadline_state m_state;
+            py::capsule m_capsule;
+            bool m_active;
+        };
+
+        constexpr std::size_t max_cached_interpreters = 8;
+        constexpr std::size_t max_cached_completions = 256;
+
+        // Returns the dotted name ending at the end of code when jedi would
+        // infer it without call signature, that is outside of any bracket,
+        // string or comment. Returns an empty string otherwise.
+        std::string inferred_dotted_name(const std::string& code)
+        {
+            if (code.find_first_of("'\"#") != std::string::npos)
+            {
+                return "";
+            }
+
+            int depth = 0;
+            for (char c : code)
+            {
+                if (c == '(' || c == '[' || c == '{')
+                {
+                    ++depth;
+                }
+                else if (c == ')' || c == ']' || c == '}')
+                {
+                    --depth;
+                }
+            }
+            if (depth != 0)
+            {
+                return "";
+            }
+
+            std::size_t start = code.size();
+            while (start != 0 && (is_identifier_char(code[start - 1]) || code[start - 1] == '.'))
+            {
+                --start;
+            }
+            std::string name = code.substr(start);
+            if (name.empty() || name.front() == '.' || name.back() == '.' ||
+                std::isdigit(static_cast<unsigned char>(name.front())))
+            {
+                return "";
+            }
+            return name;
+        }
+    }
+
+    xcompletion_engine::xcompletion_engine(std::chrono::milliseconds deadline)
+        : m_deadline(deadline)
+        , m_version(get_namespace_version())
+    {
+    }
+
+    xcompletion_engine xcompletion_engine::from_environment()
+    {
+        std::chrono::milliseconds deadline(0);
+        if (const char* value = std::getenv("XPYTHON_COMPLETION_DEADLINE"))
+        {
+            try
+            {
+                deadline = std::chrono::milliseconds(std::stol(value));
+            }
+            catch (std::exception&)
+            {
+            }
+        }
+        return xcompletion_engine(deadline);
+    }
+
+    bool xcompletion_engine::complete_cached(const std::string& code, int cursor_pos, xcompletion_result& result)
+    {
+        check_namespace_version();
+
+        if (m_index.complete(code, cursor_pos, py::globals(), result))
+        {
+            return true;
+        }
+
+        auto it = m_completions.find(code.substr(0, cursor_pos));
+        if (it != m_completions.end())
+        {
+            result = it->second;
+            return true;
+        }
+        return false;
+    }
+
+    xcompletion_result xcompletion_engine::complete(const std::string& code, int cursor_pos)
+    {
+        xcompletion_result result;
+        if (complete_cached(code, cursor_pos, result))
+        {
+            return result;
+        }
+
+        std::string sub_code = code.substr(0, cursor_pos);
+
+        try
+        {
+            xdeadline_guard deadline(m_deadline);
+            py::list completions = get_interpreter(sub_code).attr("complete")();
+            if (py::len(completions) != 0)
+            {
+                result.m_prefix_length = py::len(completions[0].attr("name_with_symbols")) - py::len(completions[0].attr("complete"));
+                result.m_matches.reserve(py::len(completions));
+                for (py::handle completion : completions)
+                {
+                    result.m_matches.push_back(completion.attr("name_with_symbols").cast<std::string>());
+                }
+            }
+        }
+        catch (py::error_already_set& e)
+        {
+            if (!e.matches(PyExc_TimeoutError))
+            {
+                throw;
+            }
+            // The interpreter may be left in an inconsistent state
+            reset_interpreters();
+            return fallback_completions(sub_code);
+        }
+
+        if (m_completions.size() >= max_cached_completions)
+        {
+            m_completions.clear();
+        }
+        m_completions[sub_code] = result;
+        return result;
+    }
+
+    std::string xcompletion_engine::docstring(const std::string& code, int cursor_pos)
+    {
+        check_namespace_version();
+
+        std::string sub_code = code.substr(0, cursor_pos);
+        std::string name = inferred_dotted_name(sub_code);
+        py::object obj = name.empty() ? py::object() : resolve_dotted_name(name, py::globals());
+
+        nl::json cached;
+        if (obj && m_inspect_cache.find(name, obj, cached))
+        {
+            return cached.get<std::string>();
+        }
+
+        try
+        {
+            xdeadline_guard deadline(m_deadline);
+            std::string res = formatted_docstring_impl(get_interpreter(sub_code));
+            if (obj)
+            {
+                m_inspect_cache.insert(name, obj, res);
+            }
+            return res;
+        }
+        catch (py::error_already_set& e)
+        {
+            if (!e.matches(PyExc_TimeoutError))
+            {
+                throw;
+            }
+            reset_interpreters();
+            return "";
+        }
+    }
+
+    std::chrono::milliseconds xcompletion_engine::deadline() const
+    {
+        return m_deadline;
+    }
+
+    void xcompletion_engine::set_deadline(std::chrono::milliseconds deadline)
+    {
+        m_deadline = deadline;
+    }
+
+    void xcompletion_engine::check_namespace_version()
+    {
+        std::size_t version = get_namespace_version();
+        if (version != m_version)
+        {
+            reset_interpreters();
+            m_completions.clear();
+            m_version = version;
+        }
+    }
+
+    void xcompletion_engine::reset_interpreters()
+    {
+        m_interpreters.clear();
+    }
+
+    py::object xcompletion_engine::get_interpreter(const std::string& code)
+    {
+        auto it = std::find_if(m_interpreters.begin(), m_interpreters.end(),
+                               [&code](const auto& entry) { return entry.first == code; });
+        if (it != m_interpreters.end())
+        {
+            m_interpreters.splice(m_interpreters.begin(), m_interpreters, it);
+            return it->second;
+        }
+
+        if (!m_jedi)
+        {
+            m_jedi = py::module::import("jedi");
+        }
+
+        py::object inter = m_jedi.attr("Interpreter")(code, py::make_tuple(py::globals()));
+        m_interpreters.emplace_front(code, inter);
+        if (m_interpreters.size() > max_cached_interpreters)
+        {
+            m_interpreters.pop_back();
+        }
+        return inter;
+    }
+
+    xcompletion_result xcompletion_engine::fallback_completions(const std::string& code) const
+    {
+        xcompletion_result result;
+        result.m_partial = true;
+
+        std::size_t start = code.size();
+        while (start != 0 && is_identifier_char(code[start - 1]))
+        {
+            --start;
+        }
+
+        // Attribute completion requires evaluating the expression
+        if (start != 0 && code[start - 1] == '.')
+        {
+            return result;
+        }
+
+        std::string prefix = code.substr(start);
+        bool include_private = !prefix.empty() && prefix[0] == '_';
+        auto add_names = [&](const py::handle& names)
+        {
+            for (py::handle name : names)
+            {
+                std::string str = py::str(name).cast<std::string>();
+                if (str.compare(0, prefix.size(), prefix) == 0 && (include_private || str[0] != '_'))
+                {
+                    result.m_matches.push_back(std::move(str));
+                }
+            }
+        };
+
+        add_names(py::globals());
+        add_names(py::module::import("builtins").attr("__dict__"));
+        add_names(py::module::import("keyword").attr("kwlist"));
+
+        std::sort(result.m_matches.begin(), result.m_matches.end());
+        result.m_matches.erase(std::unique(result.m_matches.begin(), result.m_matches.end()), result.m_matches.end());
+        // The prefix length is expressed in characters, not in bytes
+        result.m_prefix_length = static_cast<std::size_t>(std::count_if(prefix.begin(), prefix.end(),
+            [](char c) { return (static_cast<unsigned char>(c) & 0xC0) != 0x80; }));
+        return result;
+    }
 }
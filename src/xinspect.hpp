@@ -11,11 +11,22 @@
 #ifndef XPYT_INSPECT_HPP
 #define XPYT_INSPECT_HPP
 
+#include <chrono>
+#include <cstddef>
+#include <list>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
 
 #include "pybind11/pybind11.h"
 
+#include "xsymbol_index.hpp"
+
 namespace py = pybind11;
+namespace nl = nlohmann;
 
 namespace xpyt
 {
@@ -24,6 +35,103 @@ namespace xpyt
 
     std::string formatted_docstring(const std::string& code, int cursor_pos);
     std::string formatted_docstring(const std::string& code);
+
+    // Version of the user namespace, incremented whenever it may have changed.
+    // On Python 3.12+, watch_namespace installs a dict watcher so that any
+    // modification of the watched dict increments the version.
+    std::size_t get_namespace_version();
+    void bump_namespace_version();
+    bool watch_namespace(const py::dict& ns);
+
+    // Resolves a dotted name such as "np.linalg.norm" in ns, then in the
+    // builtins, without calling anything but attribute lookups. Returns a
+    // null object when the name cannot be resolved.
+    py::object resolve_dotted_name(const std::string& name, const py::dict& ns);
+
+    /******************************
+     * xinspect_cache declaration *
+     ******************************/
+
+    // Cache of inspect replies keyed by the inspected name and detail level.
+    // An entry is only reused if the name still resolves to the same object
+    // and the namespace version did not change. The cache holds weak
+    // references to the objects, it does not keep them alive and a new
+    // object cannot be mistaken for a destroyed one.
+    class xinspect_cache
+    {
+    public:
+
+        explicit xinspect_cache(std::size_t capacity = 64);
+
+        // Must be called with the GIL held
+        bool find(const std::string& key, const py::handle& obj, nl::json& data);
+        void insert(const std::string& key, const py::handle& obj, const nl::json& data);
+
+    private:
+
+        struct entry
+        {
+            py::weakref m_object;
+            nl::json m_data;
+        };
+
+        using entry_list = std::list<std::pair<std::string, entry>>;
+
+        void check_namespace_version();
+
+        std::size_t m_capacity;
+        std::size_t m_version;
+        entry_list m_entries;
+    };
+
+    /**********************************
+     * xcompletion_engine declaration *
+     **********************************/
+
+    // Long-lived jedi completion engine. Simple prefix completions are served
+    // by a symbol index without running jedi. Interpreters and completion results
+    // are reused until the namespace version changes, so that a complete
+    // request followed by an inspect request, or repeated requests on the
+    // same code, do not redo the inference. When a deadline is set, a slow
+    // inference is interrupted and completions fall back to the names of the
+    // namespace.
+    class xcompletion_engine
+    {
+    public:
+
+        explicit xcompletion_engine(std::chrono::milliseconds deadline = std::chrono::milliseconds(0));
+
+        // Builds an engine whose deadline is read from the
+        // XPYTHON_COMPLETION_DEADLINE environment variable, in milliseconds.
+        static xcompletion_engine from_environment();
+
+        // Must be called with the GIL held
+        xcompletion_result complete(const std::string& code, int cursor_pos);
+        // Answers from the symbol index and the completion cache only, without
+        // running jedi. Returns false if neither of them can answer.
+        bool complete_cached(const std::string& code, int cursor_pos, xcompletion_result& result);
+        std::string docstring(const std::string& code, int cursor_pos);
+
+        std::chrono::milliseconds deadline() const;
+        void set_deadline(std::chrono::milliseconds deadline);
+
+    private:
+
+        void check_namespace_version();
+        void reset_interpreters();
+        py::object get_interpreter(const std::string& code);
+        xcompletion_result fallback_completions(const std::string& code) const;
+
+        using interpreter_list = std::list<std::pair<std::string, py::object>>;
+
+        xsymbol_index m_index;
+        xinspect_cache m_inspect_cache;
+        std::chrono::milliseconds m_deadline;
+        std::size_t m_version;
+        py::object m_jedi;
+        interpreter_list m_interpreters;
+        std::unordered_map<std::string, xcompletion_result> m_completions;
+    };
 }
 
 #endif
@@ -8,12 +8,18 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <atomic>
+#include <cctype>
+#include <functional>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "nlohmann/json.hpp"
 
 #include "xeus/xcomm.hpp"
+#include "xeus/xinterpreter.hpp"
 #include "xeus/xsystem.hpp"
 
 #include "pybind11_json/pybind11_json.hpp"
@@ -34,7 +40,139 @@ namespace xpyt
 {
     py::module create_module(const std::string& module_name)
     {
-        return py::module_::create_extension_module(module_name.c_str(), nullptr, new py::module_::module_def);
+        py::module res = py::module_::create_extension_module(module_name.c_str(), nullptr, new py::module_::module_def);
+#ifdef Py_GIL_DISABLED
+        // The embedded modules do not rely on the GIL to protect their state,
+        // they must not re-enable it in free-threaded builds.
+        PyUnstable_Module_SetGIL(res.ptr(), Py_MOD_GIL_NOT_USED);
+#endif
+        return res;
+    }
+
+    xinterpreter_singleton::xinterpreter_singleton(const char* key, factory_type factory)
+        : m_key(std::string("xeus_python.") + key)
+        , m_factory(std::move(factory))
+        , m_main_object(nullptr)
+    {
+    }
+
+    py::object xinterpreter_singleton::get()
+    {
+#if PY_VERSION_HEX >= 0x03090000
+        PyInterpreterState* interp = PyInterpreterState_Get();
+#else
+        PyInterpreterState* interp = PyThreadState_Get()->interp;
+#endif
+        if (interp != PyInterpreterState_Main())
+        {
+            return lookup(interp);
+        }
+
+        PyObject* cached = m_main_object.load(std::memory_order_acquire);
+        if (cached != nullptr)
+        {
+            return py::reinterpret_borrow<py::object>(cached);
+        }
+        py::object res = lookup(interp);
+        m_main_object.store(res.ptr(), std::memory_order_release);
+        return res;
+    }
+
+    py::object xinterpreter_singleton::lookup(PyInterpreterState* interp)
+    {
+        PyObject* state = PyInterpreterState_GetDict(interp);
+        if (state == nullptr)
+        {
+            throw std::runtime_error("Could not access the interpreter state dictionary");
+        }
+
+        py::str key(m_key);
+#if PY_VERSION_HEX >= 0x030D0000
+        // Borrowed references to dictionary items are not safe when the GIL
+        // is disabled, the item could be replaced by another thread.
+        PyObject* item = nullptr;
+        if (PyDict_GetItemRef(state, key.ptr(), &item) < 0)
+        {
+            throw py::error_already_set();
+        }
+        if (item != nullptr)
+        {
+            return py::reinterpret_steal<py::object>(item);
+        }
+#else
+        PyObject* item = PyDict_GetItemWithError(state, key.ptr());
+        if (item != nullptr)
+        {
+            return py::reinterpret_borrow<py::object>(item);
+        }
+        if (PyErr_Occurred())
+        {
+            throw py::error_already_set();
+        }
+#endif
+
+        // The object is created outside of any lock, if several threads (or
+        // a reentrant factory) create it concurrently, the first one stored
+        // is returned to all of them.
+        py::object res = m_factory();
+#if PY_VERSION_HEX >= 0x030D0000
+        if (PyDict_SetDefaultRef(state, key.ptr(), res.ptr(), &item) < 0)
+        {
+            throw py::error_already_set();
+        }
+        return py::reinterpret_steal<py::object>(item);
+#else
+        item = PyDict_SetDefault(state, key.ptr(), res.ptr());
+        if (item == nullptr)
+        {
+            throw py::error_already_set();
+        }
+        return py::reinterpret_borrow<py::object>(item);
+#endif
+    }
+
+    namespace
+    {
+        struct kernel_interpreter_slot
+        {
+            xeus::xinterpreter* p_interpreter = nullptr;
+        };
+    }
+
+    void register_kernel_interpreter(xeus::xinterpreter& interpreter)
+    {
+        get_interpreter_local<kernel_interpreter_slot>("kernel_interpreter").p_interpreter = &interpreter;
+    }
+
+    xeus::xinterpreter& get_kernel_interpreter()
+    {
+        xeus::xinterpreter* res = get_interpreter_local<kernel_interpreter_slot>("kernel_interpreter").p_interpreter;
+        return res != nullptr ? *res : xeus::get_interpreter();
+    }
+
+    bool is_identifier_char(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+    }
+
+    namespace
+    {
+        std::atomic<bool> subshells_flag(false);
+    }
+
+    void set_subshells_enabled(bool enabled)
+    {
+        subshells_flag = enabled;
+    }
+
+    bool subshells_enabled()
+    {
+        return subshells_flag;
+    }
+
+    nl::json& get_execution_report(nl::json& reply)
+    {
+        return reply["xeus_python"];
     }
 
     std::string red_text(const std::string& text)
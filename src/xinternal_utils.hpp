@@ -12,19 +12,95 @@
 #ifndef XPYT_INTERNAL_UTILS_HPP
 #define XPYT_INTERNAL_UTILS_HPP
 
+#include <atomic>
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "nlohmann/json.hpp"
+
 #include "xeus/xcomm.hpp"
+#include "xeus/xinterpreter.hpp"
 
 #include "pybind11/pybind11.h"
 
 namespace py = pybind11;
+namespace nl = nlohmann;
 
 
 namespace xpyt
 {
     py::module create_module(const std::string& module_name);
 
+    // Object stored under a key in the state of the current interpreter,
+    // created with factory on first use. Module singletons are stored in the
+    // interpreter state rather than in function-local statics, so that they
+    // are not shared between subinterpreters and are released when the
+    // interpreter is finalized.
+    //
+    // Instances are meant to be function-local statics: the key is built
+    // once, and the object of the main interpreter is cached so that hot
+    // paths such as stream writes do not look it up. Must be called with
+    // the GIL held.
+    class xinterpreter_singleton
+    {
+    public:
+
+        using factory_type = std::function<py::object()>;
+
+        xinterpreter_singleton(const char* key, factory_type factory);
+
+        xinterpreter_singleton(const xinterpreter_singleton&) = delete;
+        xinterpreter_singleton& operator=(const xinterpreter_singleton&) = delete;
+
+        py::object get();
+
+    private:
+
+        py::object lookup(PyInterpreterState* interp);
+
+        std::string m_key;
+        factory_type m_factory;
+        // Borrowed, the reference is owned by the state of the main interpreter
+        std::atomic<PyObject*> m_main_object;
+    };
+
+    // C++ object owned by the current interpreter, for the state holding
+    // Python objects that must not cross interpreters. It is deleted when
+    // the interpreter is finalized.
+    template <class T>
+    T& get_interpreter_local(const char* key)
+    {
+        static xinterpreter_singleton singleton(key, []()
+        {
+            return py::capsule(new T(), [](void* ptr) { delete static_cast<T*>(ptr); });
+        });
+        return *static_cast<T*>(PyCapsule_GetPointer(singleton.get().ptr(), nullptr));
+    }
+
+    // The xeus interpreter of the kernel running in the current Python
+    // interpreter. xeus::get_interpreter() is shared by the whole process,
+    // while the kernel host runs one kernel per subinterpreter. Falls back
+    // to xeus::get_interpreter() when no kernel was registered. Must be
+    // called with the GIL held.
+    void register_kernel_interpreter(xeus::xinterpreter& interpreter);
+    xeus::xinterpreter& get_kernel_interpreter();
+
+    // True for the bytes that may belong to a Python identifier, non ASCII
+    // bytes are accepted since they may encode unicode letters.
+    bool is_identifier_char(char c);
+
+    // The reports of xeus-python on an execution, its phase timings and its
+    // memory accounting, are stored under the "xeus_python" key of the
+    // execute_reply content: xeus does not let interpreters set the
+    // metadata of the replies.
+    nl::json& get_execution_report(nl::json& reply);
+
+    // Whether the server hosts the subshells of the kernel subshell protocol,
+    // set when the server is built and advertised in kernel_info replies.
+    void set_subshells_enabled(bool enabled);
+    bool subshells_enabled();
+
     std::string red_text(const std::string& text);
     std::string green_text(const std::string& text);
     std::string blue_text(const std::string& text);
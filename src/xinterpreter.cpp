@@ -29,12 +29,20 @@
 #include "xeus-python/xtraceback.hpp"
 #include "xeus-python/xutils.hpp"
 
+#include "xbatch.hpp"
 #include "xcomm.hpp"
+#include "xcompletion_worker.hpp"
 #include "xkernel.hpp"
 #include "xdisplay.hpp"
 #include "xinput.hpp"
+#include "xinspect.hpp"
 #include "xinternal_utils.hpp"
+#include "xis_complete.hpp"
+#include "xmemory.hpp"
+#include "xsampler.hpp"
 #include "xstream.hpp"
+#include "xtimer.hpp"
+#include "xwarmup.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -42,6 +50,60 @@ using namespace pybind11::literals;
 
 namespace xpyt
 {
+    namespace
+    {
+        // Wraps func so that the time spent in it is recorded in the
+        // given phase of the execution timer.
+        py::object make_timed_function(py::object func, const std::string& phase)
+        {
+            return py::cpp_function([func, phase](py::args args, py::kwargs kwargs) -> py::object
+            {
+                xtimer::scope timing(get_execution_timer(), phase);
+                return func(*args, **kwargs);
+            });
+        }
+
+        // Subclass of the caching compiler of the shell recording the parsing
+        // and compilation phases of run_cell, which calls the compiler object.
+        py::module make_compiler_module()
+        {
+            py::module compiler_module = create_module("compiler");
+
+            compiler_module.def("timed", [](const std::string& phase, py::object func, py::args args, py::kwargs kwargs) -> py::object
+            {
+                xtimer::scope timing(get_execution_timer(), phase);
+                return func(*args, **kwargs);
+            });
+
+            exec(py::str(R"(
+try:
+    from xeus_python_shell.compiler import XCachingCompiler as BaseCompiler
+except ImportError:
+    from IPython.core.compilerop import CachingCompiler as BaseCompiler
+
+class XTimedCachingCompiler(BaseCompiler):
+    def ast_parse(self, *args, **kwargs):
+        return timed('parse', super().ast_parse, *args, **kwargs)
+
+    def __call__(self, *args, **kwargs):
+        return timed('compile', super().__call__, *args, **kwargs)
+
+def install(shell):
+    # Replaces the compiler created with the shell, before it compiles any
+    # cell. Compilers of other classes are left untimed.
+    if type(shell.compile) is BaseCompiler:
+        shell.compile = XTimedCachingCompiler()
+            )"), compiler_module.attr("__dict__"));
+
+            return compiler_module;
+        }
+
+        py::module get_compiler_module()
+        {
+            static xinterpreter_singleton compiler_module("compiler", make_compiler_module);
+            return py::reinterpret_borrow<py::module>(compiler_module.get());
+        }
+    }
 
     interpreter::interpreter(bool redirect_output_enabled /*=true*/, bool redirect_display_enabled /*=true*/)
         : m_redirect_output_enabled{redirect_output_enabled}, m_redirect_display_enabled{redirect_display_enabled}
@@ -55,6 +117,8 @@ namespace xpyt
 
     void interpreter::configure_impl()
     {
+        xtimer::scope startup_timing(get_startup_timer(), "configure");
+
         if (m_release_gil_at_startup)
         {
             // The GIL is not held by default by the interpreter, so every time we need to execute Python code we
@@ -63,6 +127,8 @@ namespace xpyt
         }
 
         py::gil_scoped_acquire acquire;
+        register_kernel_interpreter(*this);
+        block_native_sampling();
 
         py::module sys = py::module::import("sys");
         py::module logging = py::module::import("logging");
@@ -78,11 +144,21 @@ namespace xpyt
         // New approach: we provide our comm module
         sys.attr("modules")["comm"] = comm_module;
 
-        instanciate_ipython_shell();
-
-        m_ipython_shell_app.attr("initialize")(use_jedi_for_completion());
+        {
+            xtimer::scope startup_timing(get_startup_timer(), "shell_app_initialize");
+            instanciate_ipython_shell();
+            m_ipython_shell_app.attr("initialize")(use_jedi_for_completion());
+        }
         m_ipython_shell = m_ipython_shell_app.attr("shell");
 
+        // Resolved once, is_complete requests are sent on every key stroke
+        // by some frontends
+        m_transformer_manager = py::getattr(m_ipython_shell, "input_transformer_manager", py::none());
+        if (m_transformer_manager.is_none())
+        {
+            m_transformer_manager = m_ipython_shell.attr("input_splitter");
+        }
+
         // Setting kernel property owning the CommManager and get_parent
         m_ipython_shell.attr("kernel") = kernel_module.attr("XKernel")();
         m_ipython_shell.attr("kernel").attr("comm_manager") = comm_module.attr("CommManager")();
@@ -102,24 +178,62 @@ namespace xpyt
         m_logger.attr("addHandler")(logging.attr("StreamHandler")(m_terminal_stream));
 
         // Initializing the compiler
+        get_compiler_module().attr("install")(m_ipython_shell);
         m_ipython_shell.attr("compile").attr("filename_mapper") = traceback_module.attr("register_filename_mapping");
         m_ipython_shell.attr("compile").attr("get_filename") = traceback_module.attr("get_filename");
 
+        // Timing the input transformation phase of run_cell, the parsing and
+        // compilation phases are timed by the compiler
+        m_ipython_shell.attr("transform_cell") = make_timed_function(m_ipython_shell.attr("transform_cell"), "transform");
+
         if (m_redirect_output_enabled)
         {
             redirect_output();
         }
 
+        // Invalidates the symbol index whenever the user namespace changes
+        watch_namespace(m_ipython_shell.attr("user_ns"));
+        m_symbol_index = std::make_unique<xsymbol_index>();
+        m_inspect_cache = std::make_unique<xinspect_cache>();
+
+        if (completion_worker_enabled())
+        {
+            m_completion_worker = std::make_unique<xcompletion_worker>();
+        }
+
+        register_batch_target(comm_manager(), [this](const std::string& code, std::size_t index)
+        {
+            return run_batch_cell(code, index);
+        });
+
         py::module context_module = get_request_context_module();
     }
 
     void interpreter::execute_request_impl(send_reply_callback cb,
-                                           int /*execution_count*/,
+                                           int execution_count,
                                            const std::string& code,
                                            xeus::execute_request_config config,
                                            nl::json user_expressions)
     {
+        xnative_sampling_scope native_sampling;
+        xtimer& timer = get_execution_timer();
+        timer.start();
+
+        auto gil_wait_start = xtimer::clock_type::now();
         py::gil_scoped_acquire acquire;
+        timer.add("gil_wait", xtimer::clock_type::now() - gil_wait_start);
+
+        xmemory_tracker& memory = get_memory_tracker();
+        memory.begin();
+
+        // The worker answers completion requests received while the cell is
+        // running, it is given the namespace as left by the previous cells.
+        if (m_completion_worker)
+        {
+            m_completion_worker->update_namespace(m_ipython_shell.attr("user_ns"));
+        }
+        xbusy_guard busy(m_busy);
+
         nl::json kernel_res;
 
         // Reset traceback
@@ -130,6 +244,7 @@ namespace xpyt
         auto input_guard = input_redirection(config.allow_stdin);
 
         bool exception_occurred = false;
+        auto run_start = xtimer::clock_type::now();
         try
         {
             m_ipython_shell.attr("run_cell")(code, "store_history"_a=config.store_history, "silent"_a=config.silent);
@@ -170,14 +285,28 @@ namespace xpyt
             exception_occurred = true;
         }
 
+        // Parsing, compilation and publishing happen within run_cell, they are
+        // reported separately from the time spent running user code.
+        timer.add_exclusive("run", xtimer::clock_type::now() - run_start, {"transform", "parse", "compile", "publish"});
+
+        // Imported modules and mutated objects are not tracked by the namespace
+        // watcher, completion caches are invalidated after every execution.
+        bump_namespace_version();
+
         // Get payload
-        kernel_res["payload"] = m_ipython_shell.attr("payload_manager").attr("read_payload")();
-        m_ipython_shell.attr("payload_manager").attr("clear_payload")();
+        {
+            xtimer::scope timing(timer, "payload");
+            kernel_res["payload"] = m_ipython_shell.attr("payload_manager").attr("read_payload")();
+            m_ipython_shell.attr("payload_manager").attr("clear_payload")();
+        }
 
         if(exception_occurred)
         {
             kernel_res["status"] = "error";
             kernel_res["traceback"] = std::vector<std::string>();
+            timer.stop();
+            get_execution_report(kernel_res)["timings"] = timer.to_json();
+            add_memory_report(kernel_res, memory.end(execution_count));
             cb(kernel_res);
             return;
         }
@@ -203,6 +332,9 @@ namespace xpyt
             kernel_res["evalue"] = error.m_evalue;
             kernel_res["traceback"] = error.m_traceback;
         }
+        timer.stop();
+        get_execution_report(kernel_res)["timings"] = timer.to_json();
+        add_memory_report(kernel_res, memory.end(execution_count));
         cb(kernel_res);
     }
 
@@ -211,8 +343,37 @@ namespace xpyt
         int cursor_pos)
     {
         py::gil_scoped_acquire acquire;
+        if (m_busy && m_completion_worker)
+        {
+            return m_completion_worker->complete(code, cursor_pos);
+        }
+
         nl::json kernel_res;
 
+        // Bare identifiers and module attributes do not need the IPython completer
+        xcompletion_result result;
+        if (m_symbol_index && m_symbol_index->complete(code, cursor_pos, m_ipython_shell.attr("user_ns"), result))
+        {
+            kernel_res["matches"] = std::move(result.m_matches);
+            kernel_res["cursor_start"] = cursor_pos - static_cast<int>(result.m_prefix_length);
+            kernel_res["cursor_end"] = cursor_pos;
+            kernel_res["metadata"] = nl::json::object();
+            kernel_res["status"] = "ok";
+            return kernel_res;
+        }
+
+        // The request was dispatched while a cell is running, the IPython
+        // completer could evaluate user code and is not run concurrently
+        if (m_busy)
+        {
+            kernel_res["matches"] = nl::json::array();
+            kernel_res["cursor_start"] = cursor_pos;
+            kernel_res["cursor_end"] = cursor_pos;
+            kernel_res["metadata"] = nl::json::object();
+            kernel_res["status"] = "ok";
+            return kernel_res;
+        }
+
         py::list completion = m_ipython_shell.attr("complete_code")(code, cursor_pos);
 
         kernel_res["matches"] = completion[0];
@@ -229,6 +390,11 @@ namespace xpyt
                                                int detail_level)
     {
         py::gil_scoped_acquire acquire;
+        if (m_busy && m_completion_worker)
+        {
+            return m_completion_worker->inspect(code, cursor_pos, detail_level);
+        }
+
         nl::json kernel_res;
         nl::json data = nl::json::object();
         bool found = false;
@@ -236,17 +402,35 @@ namespace xpyt
         py::module tokenutil = py::module::import("IPython.utils.tokenutil");
         py::str name = tokenutil.attr("token_at_cursor")(code, cursor_pos);
 
-        try
+        // Hover tooltips inspect the same objects over and over, the rendered
+        // bundle is reused as long as the name resolves to the same object.
+        // The name is resolved with attribute lookups only, so that a cache
+        // miss does not cost a second lookup by the shell.
+        std::string cache_key = name.cast<std::string>() + "/" + std::to_string(detail_level);
+        py::object obj = resolve_dotted_name(name.cast<std::string>(), m_ipython_shell.attr("user_ns"));
+
+        if (obj && m_inspect_cache->find(cache_key, obj, data))
         {
-            data = m_ipython_shell.attr("object_inspect_mime")(
-                name,
-                "detail_level"_a=detail_level
-            );
             found = true;
         }
-        catch (py::error_already_set& e)
+        else
         {
-            // pass
+            try
+            {
+                data = m_ipython_shell.attr("object_inspect_mime")(
+                    name,
+                    "detail_level"_a=detail_level
+                );
+                found = true;
+                if (obj)
+                {
+                    m_inspect_cache->insert(cache_key, obj, data);
+                }
+            }
+            catch (py::error_already_set& e)
+            {
+                // pass
+            }
         }
 
         kernel_res["data"] = data;
@@ -261,13 +445,14 @@ namespace xpyt
         py::gil_scoped_acquire acquire;
         nl::json kernel_res;
 
-        py::object transformer_manager = py::getattr(m_ipython_shell, "input_transformer_manager", py::none());
-        if (transformer_manager.is_none())
+        // Plain Python code is checked natively, IPython handles the magics
+        // and the cases the native checker cannot decide
+        if (check_complete(code, kernel_res))
         {
-            transformer_manager = m_ipython_shell.attr("input_splitter");
+            return kernel_res;
         }
 
-        py::list result = transformer_manager.attr("check_complete")(code);
+        py::list result = m_transformer_manager.attr("check_complete")(code);
         auto status = result[0].cast<std::string>();
 
         kernel_res["status"] = status;
@@ -280,6 +465,8 @@ namespace xpyt
 
     nl::json interpreter::kernel_info_request_impl()
     {
+        on_kernel_info_request();
+
         nl::json result;
         result["implementation"] = "xeus-python";
         result["implementation_version"] = XPYT_VERSION;
@@ -311,6 +498,10 @@ namespace xpyt
 #endif
         result["banner"] = banner;
         result["debugger"] = true;
+        if (subshells_enabled())
+        {
+            result["supported_features"] = nl::json::array({"kernel subshells"});
+        }
 
         result["language_info"]["name"] = "python";
         result["language_info"]["version"] = PY_VERSION;
@@ -329,6 +520,7 @@ namespace xpyt
 
     void interpreter::shutdown_request_impl()
     {
+        join_warmup();
     }
 
     nl::json interpreter::internal_request_impl(const nl::json& content)
@@ -367,38 +559,63 @@ namespace xpyt
         return reply;
     }
 
-    void interpreter::set_request_context(xeus::xrequest_context context)
+    nl::json interpreter::run_batch_cell(const std::string& code, std::size_t /*index*/)
     {
-        py::gil_scoped_acquire acquire;
-        py::module context_module = get_request_context_module();
-        context_module.attr("set_request_context")(context);
-    }
+        xbusy_guard busy(m_busy);
+        nl::json result;
 
-    namespace
-    {
-        xeus::xrequest_context empty_request_context{};
-    }
+        // Reset traceback
+        m_ipython_shell.attr("last_error") = py::none();
 
-    const xeus::xrequest_context& interpreter::get_request_context() const noexcept
-    {
-        py::gil_scoped_acquire acquire;
-        py::module context_module = get_request_context_module();
-        // When the debugger is started, it send some python code to execute, that triggers
-        // a call to publish_stream, and ultimately to this function. However:
-        // - we are out of the handling of an execute_request, therefore set_request_context
-        // has not been called
-        // - we cannot set it from another thread (the context of the context variable would
-        // be different)
-        // Therefore, we have to catch the exception thrown when the context variable is empty.
+        // Batch cells are not stored in the history, the execution count
+        // must stay in sync with the one of the execute requests
         try
         {
-            py::object res = context_module.attr("get_request_context")();
-            return *(res.cast<xeus::xrequest_context*>());
+            m_ipython_shell.attr("run_cell")(code, "store_history"_a=false, "silent"_a=false);
         }
         catch (py::error_already_set& e)
         {
-            return empty_request_context;
+            xerror error = extract_already_set_error(e);
+            publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
+
+            result["status"] = "error";
+            result["ename"] = error.m_ename;
+            result["evalue"] = error.m_evalue;
+            result["traceback"] = error.m_traceback;
+            return result;
+        }
+
+        // Payloads are meant for execute replies, there is none in a batch
+        m_ipython_shell.attr("payload_manager").attr("clear_payload")();
+
+        if (m_ipython_shell.attr("last_error").is_none())
+        {
+            result["status"] = "ok";
+        }
+        else
+        {
+            py::list pyerror = m_ipython_shell.attr("last_error");
+            xerror error = extract_error(pyerror);
+            publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
+
+            result["status"] = "error";
+            result["ename"] = error.m_ename;
+            result["evalue"] = error.m_evalue;
+            result["traceback"] = error.m_traceback;
         }
+        return result;
+    }
+
+    void interpreter::set_request_context(xeus::xrequest_context context)
+    {
+        py::gil_scoped_acquire acquire;
+        set_current_request_context(context);
+    }
+
+    const xeus::xrequest_context& interpreter::get_request_context() const noexcept
+    {
+        py::gil_scoped_acquire acquire;
+        return get_current_request_context();
     }
 
     void interpreter::redirect_output()
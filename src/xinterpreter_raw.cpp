@@ -29,13 +29,22 @@
 #include "xeus-python/xtraceback.hpp"
 #include "xeus-python/xutils.hpp"
 
+#include "xbatch.hpp"
+#include "xcode_cache.hpp"
+#include "xcompletion_worker.hpp"
 #include "xcomm.hpp"
 #include "xkernel.hpp"
 #include "xdisplay.hpp"
 #include "xinput.hpp"
 #include "xinternal_utils.hpp"
+#include "xis_complete.hpp"
+#include "xmemory.hpp"
+#include "xprofiler.hpp"
+#include "xsampler.hpp"
 #include "xstream.hpp"
 #include "xinspect.hpp"
+#include "xtimer.hpp"
+#include "xwarmup.hpp"
 
 namespace py = pybind11;
 namespace nl = nlohmann;
@@ -45,7 +54,9 @@ namespace xpyt
 {
 
     raw_interpreter::raw_interpreter(bool redirect_output_enabled /*=true*/, bool redirect_display_enabled /*=true*/)
-        :m_redirect_display_enabled{ redirect_display_enabled }
+        : m_code_cache(std::make_unique<xcode_cache>(xcode_cache::from_environment()))
+        , m_completion_engine(std::make_unique<xcompletion_engine>(xcompletion_engine::from_environment()))
+        , m_redirect_display_enabled{ redirect_display_enabled }
     {
         xeus::register_interpreter(this);
         if (redirect_output_enabled)
@@ -60,6 +71,8 @@ namespace xpyt
 
     void raw_interpreter::configure_impl()
     {
+        xtimer::scope startup_timing(get_startup_timer(), "configure");
+
         if (m_release_gil_at_startup)
         {
             // The GIL is not held by default by the interpreter, so every time we need to execute Python code we
@@ -68,6 +81,8 @@ namespace xpyt
         }
 
         py::gil_scoped_acquire acquire;
+        register_kernel_interpreter(*this);
+        block_native_sampling();
 
         py::module sys = py::module::import("sys");
         py::module jedi = py::module::import("jedi");
@@ -104,6 +119,19 @@ namespace xpyt
         py::globals()["_ii"] = "";
         py::globals()["_iii"] = "";
 
+        // Invalidates the completion caches whenever the user namespace changes
+        watch_namespace(py::globals());
+
+        if (completion_worker_enabled())
+        {
+            m_completion_worker = std::make_unique<xcompletion_worker>();
+        }
+
+        register_batch_target(comm_manager(), [this](const std::string& code, std::size_t index)
+        {
+            return run_batch_cell(code, index);
+        });
+
         py::module context_module = get_request_context_module();
     }
 
@@ -114,43 +142,51 @@ namespace xpyt
         xeus::execute_request_config config,
         nl::json /*user_expressions*/)
     {
+        xnative_sampling_scope native_sampling;
+        xtimer& timer = get_execution_timer();
+        timer.start();
+
+        auto gil_wait_start = xtimer::clock_type::now();
         py::gil_scoped_acquire acquire;
+        timer.add("gil_wait", xtimer::clock_type::now() - gil_wait_start);
+
+        xmemory_tracker& memory = get_memory_tracker();
+        memory.begin();
+
+        // The worker answers completion requests received while the cell is
+        // running, it is given the namespace as left by the previous cells.
+        if (m_completion_worker)
+        {
+            m_completion_worker->update_namespace(py::globals());
+        }
+        xbusy_guard busy(m_busy);
+
+        if (!config.silent && config.store_history)
+        {
+            m_execution_count = execution_count;
+        }
+
         nl::json kernel_res;
-        py::str code_copy;
         // Scope guard performing the temporary monkey patching of input and
         // getpass with a function sending input_request messages.
         auto input_guard = input_redirection(config.allow_stdin);
-        code_copy = code;
+        bool run_started = false;
+        auto run_start = xtimer::clock_type::now();
         try
         {
-            // Import modules
-            py::module ast = py::module::import("ast");
-            py::module builtins = py::module::import("builtins");
-
-            // Parse code to AST
-            py::object code_ast = ast.attr("parse")(code_copy, "<string>", "exec");
-            py::list expressions = code_ast.attr("body");
-
             std::string filename = get_cell_tmp_file(code);
             register_filename_mapping(filename, execution_count);
 
+            // Parsing and compilation are skipped for cells that already ran
+            const xcompiled_cell& cell = m_code_cache->get(code, filename, timer);
+            py::object compiled_code = cell.m_body;
+            py::object compiled_interactive_code = cell.m_interactive;
 
-            // If the last statement is an expression, we compile it separately
-            // in an interactive mode (This will trigger the display hook)
-            py::object last_stmt = expressions[py::len(expressions) - 1];
-            if (py::isinstance(last_stmt, ast.attr("Expr")))
+            run_started = true;
+            run_start = xtimer::clock_type::now();
+            xprofiler::scope profiling(get_profiler());
+            if (compiled_interactive_code)
             {
-                code_ast.attr("body").attr("pop")();
-
-                py::list interactive_nodes;
-                interactive_nodes.append(last_stmt);
-
-                py::object interactive_ast = ast.attr("Interactive")(interactive_nodes);
-
-                py::object compiled_code = builtins.attr("compile")(code_ast, filename, "exec");
-
-                py::object compiled_interactive_code = builtins.attr("compile")(interactive_ast, filename, "single");
-
                 if (m_displayhook.ptr() != nullptr)
                 {
                     m_displayhook.attr("set_execution_count")(execution_count);
@@ -161,7 +197,6 @@ namespace xpyt
             }
             else
             {
-                py::object compiled_code = builtins.attr("compile")(code_ast, filename, "exec");
                 exec(compiled_code);
             }
 
@@ -193,52 +228,123 @@ namespace xpyt
             kernel_res["traceback"] = error.m_traceback;
         }
 
+        if (run_started)
+        {
+            timer.add_exclusive("run", xtimer::clock_type::now() - run_start, {"publish"});
+        }
+
+        nl::json profile = get_profiler().take_mime_bundle();
+        if (!profile.is_null() && !config.silent)
+        {
+            display_data(std::move(profile), nl::json::object(), nl::json::object());
+        }
+
+        // Imported modules and mutated objects are not tracked by the namespace
+        // watcher, completion caches are invalidated after every execution.
+        bump_namespace_version();
+
         // Cache inputs
         py::globals()["_iii"] = py::globals()["_ii"];
         py::globals()["_ii"] = py::globals()["_i"];
         py::globals()["_i"] = code;
 
+        timer.stop();
+        get_execution_report(kernel_res)["timings"] = timer.to_json();
+        add_memory_report(kernel_res, memory.end(execution_count));
         cb(kernel_res);
     }
 
+    nl::json raw_interpreter::run_batch_cell(const std::string& code, std::size_t index)
+    {
+        xbusy_guard busy(m_busy);
+        nl::json result;
+        try
+        {
+            // Batch cells are not stored in the history, their results and
+            // tracebacks refer to the next execution count, as in IPython. The
+            // filename is not the one of an execute request with the same code
+            // so that the mapping of that request is not overwritten.
+            int execution_count = m_execution_count + 1;
+            std::string filename = get_cell_tmp_file("# batch cell " + std::to_string(index) + "\n" + code);
+            register_filename_mapping(filename, execution_count);
+
+            const xcompiled_cell& cell = m_code_cache->get(code, filename, get_execution_timer());
+            exec(cell.m_body);
+            if (cell.m_interactive)
+            {
+                if (m_displayhook.ptr() != nullptr)
+                {
+                    m_displayhook.attr("set_execution_count")(execution_count);
+                }
+                exec(cell.m_interactive);
+            }
+            result["status"] = "ok";
+        }
+        catch (py::error_already_set& e)
+        {
+            xerror error = extract_already_set_error(e);
+            publish_execution_error(error.m_ename, error.m_evalue, error.m_traceback);
+
+            result["status"] = "error";
+            result["ename"] = error.m_ename;
+            result["evalue"] = error.m_evalue;
+            result["traceback"] = error.m_traceback;
+        }
+        return result;
+    }
+
     nl::json raw_interpreter::complete_request_impl(
         const std::string& code,
         int cursor_pos)
     {
         py::gil_scoped_acquire acquire;
-        nl::json kernel_res;
-        std::vector<std::string> matches;
-        int cursor_start = cursor_pos;
+        if (m_busy && m_completion_worker)
+        {
+            return m_completion_worker->complete(code, cursor_pos);
+        }
 
-        py::list completions = get_completions(code, cursor_pos);
+        nl::json kernel_res;
 
-        if (py::len(completions) != 0)
+        // The request was dispatched while a cell is running, jedi could
+        // evaluate user code and is not run concurrently
+        xcompletion_result completions;
+        if (!m_busy)
         {
-            cursor_start -= py::len(completions[0].attr("name_with_symbols")) - py::len(completions[0].attr("complete"));
-            for (py::handle completion : completions)
-            {
-                matches.push_back(completion.attr("name_with_symbols").cast<std::string>());
-            }
+            completions = m_completion_engine->complete(code, cursor_pos);
+        }
+        else if (!m_completion_engine->complete_cached(code, cursor_pos, completions))
+        {
+            completions = xcompletion_result();
         }
 
-        kernel_res["cursor_start"] = cursor_start;
+        kernel_res["cursor_start"] = cursor_pos - static_cast<int>(completions.m_prefix_length);
         kernel_res["cursor_end"] = cursor_pos;
-        kernel_res["matches"] = matches;
+        kernel_res["matches"] = std::move(completions.m_matches);
         kernel_res["metadata"] = nl::json::object();
+        if (completions.m_partial)
+        {
+            // The deadline expired, only the names of the namespace were searched
+            kernel_res["metadata"]["partial"] = true;
+        }
         kernel_res["status"] = "ok";
         return kernel_res;
     }
 
     nl::json raw_interpreter::inspect_request_impl(const std::string& code,
         int cursor_pos,
-        int /*detail_level*/)
+        int detail_level)
     {
 
         py::gil_scoped_acquire acquire;
+        if (m_busy && m_completion_worker)
+        {
+            return m_completion_worker->inspect(code, cursor_pos, detail_level);
+        }
+
         nl::json kernel_res;
         nl::json pub_data;
 
-        std::string docstring = formatted_docstring(code, cursor_pos);
+        std::string docstring = m_completion_engine->docstring(code, cursor_pos);
 
         bool found = false;
         if (!docstring.empty())
@@ -254,15 +360,24 @@ namespace xpyt
         return kernel_res;
     }
 
-    nl::json raw_interpreter::is_complete_request_impl(const std::string&)
+    nl::json raw_interpreter::is_complete_request_impl(const std::string& code)
     {
+        py::gil_scoped_acquire acquire;
         nl::json result;
-        result["status"] = "complete";
+        if (!check_complete(code, result))
+        {
+            // Undecided inputs are sent for execution, errors are
+            // reported by the execute_reply
+            result = nl::json::object();
+            result["status"] = "complete";
+        }
         return result;
     }
 
     nl::json raw_interpreter::kernel_info_request_impl()
     {
+        on_kernel_info_request();
+
         nl::json result;
         result["implementation"] = "xeus-python";
         result["implementation_version"] = XPYT_VERSION;
@@ -294,6 +409,10 @@ namespace xpyt
 #endif
         result["banner"] = banner;
         result["debugger"] = false;
+        if (subshells_enabled())
+        {
+            result["supported_features"] = nl::json::array({"kernel subshells"});
+        }
 
         result["language_info"]["name"] = "python";
         result["language_info"]["version"] = PY_VERSION;
@@ -314,21 +433,19 @@ namespace xpyt
 
     void raw_interpreter::shutdown_request_impl()
     {
+        join_warmup();
     }
 
     void raw_interpreter::set_request_context(xeus::xrequest_context context)
     {
         py::gil_scoped_acquire acquire;
-        py::module context_module = get_request_context_module();
-        context_module.attr("set_request_context")(context);
+        set_current_request_context(context);
     }
 
     const xeus::xrequest_context& raw_interpreter::get_request_context() const noexcept
     {
         py::gil_scoped_acquire acquire;
-        py::module context_module = get_request_context_module();
-        py::object res = context_module.attr("get_request_context")();
-        return *(res.cast<xeus::xrequest_context*>());
+        return get_current_request_context();
     }
 
     void raw_interpreter::redirect_output()
@@ -0,0 +1,273 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xinternal_utils.hpp"
+#include "xis_complete.hpp"
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    namespace
+    {
+        bool is_blank(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\f';
+        }
+
+        // Equivalent of IPython's find_last_indent, tabs count as 4 spaces
+        std::size_t last_indent(const std::string& code)
+        {
+            std::size_t end = code.size();
+            if (end != 0 && code[end - 1] == '\n')
+            {
+                --end;
+            }
+            std::size_t start = code.rfind('\n', end == 0 ? 0 : end - 1);
+            start = (start == std::string::npos || start >= end) ? 0 : start + 1;
+
+            std::size_t indent = 0;
+            for (std::size_t i = start; i < end && (code[i] == ' ' || code[i] == '\t'); ++i)
+            {
+                indent += code[i] == '\t' ? 4 : 1;
+            }
+            return indent;
+        }
+
+        nl::json complete()
+        {
+            return {{"status", "complete"}};
+        }
+
+        nl::json incomplete(std::size_t indent)
+        {
+            return {{"status", "incomplete"}, {"indent", std::string(indent, ' ')}};
+        }
+
+        // Syntax warnings are turned into errors, as in IPython's check
+        // of the code that looks complete.
+        bool compiles(const std::string& code)
+        {
+            py::module warnings = py::module::import("warnings");
+            py::object catcher = warnings.attr("catch_warnings")();
+            catcher.attr("__enter__")();
+            warnings.attr("simplefilter")("error", py::handle(PyExc_SyntaxWarning));
+
+            PyObject* res = Py_CompileString(code.c_str(), "<input>", Py_file_input);
+            bool success = res != nullptr;
+            Py_XDECREF(res);
+            PyErr_Clear();
+
+            catcher.attr("__exit__")(py::none(), py::none(), py::none());
+            return success;
+        }
+    }
+
+    bool check_complete(const std::string& code, nl::json& result)
+    {
+        // IPython syntax, blank inputs and inputs with a leading indent,
+        // which IPython strips, are left to IPython
+        std::size_t first = code.find_first_not_of(" \t\r\n\f");
+        if (first == std::string::npos || is_blank(code[0]) || code[first] == '%' || code[first] == '!' || code[first] == '?')
+        {
+            return false;
+        }
+
+        int depth = 0;
+        char quote = 0;
+        bool triple = false;
+        bool at_line_start = true;
+        bool continuation = false;
+        std::size_t line_indent = 0;
+        std::size_t logical_indent = 0;
+        char last_significant = 0;
+
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            char c = code[i];
+
+            if (quote != 0)
+            {
+                if (c == '\\')
+                {
+                    ++i;
+                }
+                else if (c == quote && (!triple || code.compare(i, 3, std::string(3, quote)) == 0))
+                {
+                    i += triple ? 2 : 0;
+                    quote = 0;
+                    last_significant = c;
+                }
+                else if (c == '\n' && !triple)
+                {
+                    // Unterminated single quoted string
+                    return false;
+                }
+                continue;
+            }
+
+            if (at_line_start)
+            {
+                if (is_blank(c))
+                {
+                    line_indent += 1;
+                    continue;
+                }
+                at_line_start = false;
+                if (c != '\n' && c != '#' && depth == 0 && !continuation)
+                {
+                    // First token of a logical line
+                    if (c == '%' || c == '!' || c == '?')
+                    {
+                        return false;
+                    }
+                    logical_indent = line_indent;
+                }
+                continuation = false;
+            }
+
+            switch (c)
+            {
+            case '\n':
+                at_line_start = true;
+                line_indent = 0;
+                break;
+            case '#':
+                while (i + 1 < code.size() && code[i + 1] != '\n')
+                {
+                    ++i;
+                }
+                break;
+            case '\\':
+                if (i + 1 < code.size() && code[i + 1] == '\n')
+                {
+                    continuation = true;
+                    at_line_start = true;
+                    line_indent = 0;
+                    ++i;
+                }
+                else if (i + 1 == code.size())
+                {
+                    // Explicit backslash continuation
+                    result = incomplete(last_indent(code));
+                    return true;
+                }
+                else
+                {
+                    last_significant = c;
+                }
+                break;
+            case '\'':
+            case '"':
+            {
+                // f-strings may nest quotes of the same kind
+                for (std::size_t j = i; j != 0 && is_identifier_char(code[j - 1]); --j)
+                {
+                    char p = code[j - 1];
+                    if (p == 'f' || p == 'F' || p == 't' || p == 'T')
+                    {
+                        return false;
+                    }
+                }
+                quote = c;
+                triple = code.compare(i, 3, std::string(3, c)) == 0;
+                i += triple ? 2 : 0;
+                break;
+            }
+            case '(':
+            case '[':
+            case '{':
+                ++depth;
+                last_significant = c;
+                break;
+            case ')':
+            case ']':
+            case '}':
+                if (--depth < 0)
+                {
+                    return false;
+                }
+                last_significant = c;
+                break;
+            case '?':
+                return false;
+            case '!':
+                if (i + 1 >= code.size() || code[i + 1] != '=')
+                {
+                    return false;
+                }
+                last_significant = c;
+                break;
+            case '%':
+            {
+                // Line magics assigned to a variable, e.g. x = %time f()
+                std::size_t prev = code.find_last_not_of(" \t", i == 0 ? 0 : i - 1);
+                if (prev != std::string::npos && code[prev] == '=')
+                {
+                    return false;
+                }
+                last_significant = c;
+                break;
+            }
+            default:
+                if (!is_blank(c))
+                {
+                    last_significant = c;
+                }
+                break;
+            }
+        }
+
+        // Unterminated single quoted string
+        if (quote != 0 && !triple)
+        {
+            return false;
+        }
+
+        // Inside a triple quoted string, brackets or a continuation line
+        if (quote != 0 || depth != 0 || continuation)
+        {
+            result = incomplete(last_indent(code));
+            return true;
+        }
+
+        // The last line starts a block
+        if (last_significant == ':')
+        {
+            result = incomplete(logical_indent + 4);
+            return true;
+        }
+
+        if (!compiles(code))
+        {
+            return false;
+        }
+
+        // An indented block is terminated by a blank line
+        std::size_t last = code.find_last_not_of(" \t\r\f");
+        bool ends_with_newline = last != std::string::npos && code[last] == '\n';
+        if (logical_indent != 0 && !ends_with_newline)
+        {
+            result = incomplete(last_indent(code));
+            return true;
+        }
+
+        result = complete();
+        return true;
+    }
+}
@@ -0,0 +1,35 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_IS_COMPLETE_HPP
+#define XPYT_IS_COMPLETE_HPP
+
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    // Native implementation of the completeness check performed by IPython's
+    // TransformerManager.check_complete. It scans brackets, strings, comments,
+    // backslash continuations, trailing colons and indentation, and compiles
+    // the code when it looks complete.
+    //
+    // Returns false when the code contains IPython syntax (magics, shell
+    // escapes, help requests), f-strings, or when the result cannot be
+    // decided natively. The caller must then defer to IPython. On success,
+    // result holds the content of the is_complete_reply. Must be called with
+    // the GIL held.
+    bool check_complete(const std::string& code, nl::json& result);
+}
+
+#endif
@@ -8,6 +8,7 @@
 * The full license is in the file LICENSE, distributed with this software. *
 ****************************************************************************/
 
+#include <cstddef>
 #include <string>
 #include <utility>
 
@@ -26,6 +27,10 @@
 
 #include "xkernel.hpp"
 #include "xinternal_utils.hpp"
+#include "xmemory.hpp"
+#include "xshared_memory.hpp"
+#include "xtimeit.hpp"
+#include "xtimer.hpp"
 
 #ifdef __GNUC__
 #pragma GCC diagnostic push
@@ -36,6 +41,43 @@ namespace py = pybind11;
 namespace nl = nlohmann;
 using namespace pybind11::literals;
 
+namespace xpyt
+{
+    // Methods of the kernel objects controlling and querying the per-cell
+    // memory accounting
+    template <class K>
+    void bind_memory_tracking(py::class_<K>& kernel_class)
+    {
+        kernel_class
+            .def("enable_memory_tracking", [](const K&, bool tracemalloc, std::size_t top)
+                {
+                    get_memory_tracker().enable(tracemalloc, top);
+                },
+                "tracemalloc"_a=false, "top"_a=10)
+            .def("disable_memory_tracking", [](const K&) { get_memory_tracker().disable(); })
+            .def("memory_usage", [](const K&) { return get_memory_tracker().last_report(); })
+            .def("memory_history", [](const K&) { return get_memory_tracker().history(); });
+    }
+
+    // timeit method of the kernel objects, timing a statement in the
+    // namespace of the caller and publishing the statistics
+    template <class K>
+    void bind_timeit(py::class_<K>& kernel_class)
+    {
+        kernel_class
+            .def("timeit", [](const K&, const std::string& stmt, const std::string& setup, std::size_t number, std::size_t repeat, bool publish)
+                {
+                    nl::json result = timeit(stmt, setup, number, repeat, py::globals());
+                    if (publish)
+                    {
+                        get_kernel_interpreter().display_data(make_timeit_mime_bundle(result), nl::json::object(), nl::json::object());
+                    }
+                    return result;
+                },
+                "stmt"_a, "setup"_a="pass", "number"_a=0, "repeat"_a=7, "publish"_a=true);
+    }
+}
+
 namespace xpyt_ipython
 {
     /***********************
@@ -46,7 +88,7 @@ namespace xpyt_ipython
     {
         xkernel() = default;
 
-        py::dict get_parent();
+        py::object get_parent();
 
         py::object m_comm_manager;
     };
@@ -55,9 +97,9 @@ namespace xpyt_ipython
      * xkernel implementation *
      **************************/
 
-    py::dict xkernel::get_parent()
+    py::object xkernel::get_parent()
     {
-        return py::dict(py::arg("header") = xeus::get_interpreter().parent_header().get<py::object>());
+        return xpyt::get_cached_parent_header();
     }
 
     /*****************
@@ -68,11 +110,15 @@ namespace xpyt_ipython
     {
         py::module kernel_module = xpyt::create_module("kernel");
 
-        py::class_<xkernel>(kernel_module, "XKernel")
+        py::class_<xkernel> kernel_class(kernel_module, "XKernel");
+        kernel_class
             .def(py::init<>())
             .def("get_parent", &xkernel::get_parent)
             .def_property_readonly("_parent_header", &xkernel::get_parent)
+            .def("execution_timings", [](const xkernel&) { return xpyt::get_execution_timer().last_to_json(); })
             .def_readwrite("comm_manager", &xkernel::m_comm_manager);
+        xpyt::bind_memory_tracking(kernel_class);
+        xpyt::bind_timeit(kernel_class);
 
         return kernel_module;
     }
@@ -97,7 +143,7 @@ namespace xpyt_raw
 
         inline py::object parent_header() const
         {
-            return py::dict(py::arg("header") = xeus::get_interpreter().parent_header().get<py::object>());
+            return xpyt::get_cached_parent_header();
         }
 
         xpyt::xcomm_manager m_comm_manager;
@@ -169,22 +215,36 @@ namespace xpyt_raw
             )
             .def("close", &xpyt::xcomm::close, "data"_a=py::dict(), "metadata"_a=py::dict(), "buffers"_a=py::list())
             .def("send", &xpyt::xcomm::send, "data"_a=py::dict(), "metadata"_a=py::dict(), "buffers"_a=py::list())
-            .def("on_msg", &xpyt::xcomm::on_msg)
+            .def("on_msg", &xpyt::xcomm::on_msg, "callback"_a, "raw"_a=false, "encoding"_a="json")
             .def("on_close", &xpyt::xcomm::on_close)
+            .def("send_stream", &xpyt::xcomm::send_stream,
+                 "buffer"_a, "data"_a=py::dict(), "metadata"_a=py::dict(),
+                 "chunk_size"_a=1 << 20, "window"_a=4, "on_complete"_a=py::none())
+            .def("cancel_stream", &xpyt::xcomm::cancel_stream, "stream_id"_a)
+            .def_property_readonly("pending_streams", &xpyt::xcomm::pending_streams)
+            .def("enable_shared_memory", &xpyt::xcomm::enable_shared_memory, "threshold"_a=1 << 20)
+            .def("disable_shared_memory", &xpyt::xcomm::disable_shared_memory)
             .def_property_readonly("comm_id", &xpyt::xcomm::comm_id)
             .def_property_readonly("kernel", &xpyt::xcomm::kernel);
 
         py::class_<xpyt::xcomm_manager>(kernel_module, "CommManager")
             .def(py::init<>())
-            .def("register_target", &xpyt::xcomm_manager::register_target);
+            .def("register_target", &xpyt::xcomm_manager::register_target,
+                 "target_name"_a, "callback"_a, "raw"_a=false, "encoding"_a="json");
+
+        kernel_module.def("read_shared_memory", &xpyt::read_shared_memory, "name"_a, "size"_a);
     }
 
     void bind_mock_objects(py::module& kernel_module)
     {
-        py::class_<xmock_kernel>(kernel_module, "MockKernel", py::dynamic_attr())
+        py::class_<xmock_kernel> kernel_class(kernel_module, "MockKernel", py::dynamic_attr());
+        kernel_class
             .def(py::init<>())
             .def_property_readonly("_parent_header", &xmock_kernel::parent_header)
+            .def("execution_timings", [](const xmock_kernel&) { return xpyt::get_execution_timer().last_to_json(); })
             .def_readwrite("comm_manager", &xmock_kernel::m_comm_manager);
+        xpyt::bind_memory_tracking(kernel_class);
+        xpyt::bind_timeit(kernel_class);
 
         py::class_<xmock_ipython>(kernel_module, "MockIPython")
             .def(py::init<>())
@@ -251,19 +311,9 @@ namespace xpyt
 {
     py::module get_kernel_module(bool raw_mode /*false*/)
     {
-
-        static py::module kernel_module;
-        if (raw_mode)
-        {
-            kernel_module = xpyt_raw::get_kernel_module_impl();
-        }
-        else
-        {
-
-            kernel_module = xpyt_ipython::get_kernel_module_impl();
-        }
-
-        return kernel_module;
+        static xinterpreter_singleton raw_kernel_module("raw_kernel", xpyt_raw::get_kernel_module_impl);
+        static xinterpreter_singleton kernel_module("kernel", xpyt_ipython::get_kernel_module_impl);
+        return py::reinterpret_borrow<py::module>(raw_mode ? raw_kernel_module.get() : kernel_module.get());
     }
 
     py::module make_request_context_module()
@@ -277,12 +327,17 @@ namespace xpyt
         exec(py::str(R"(
 import contextvars as cv
 request_context = cv.ContextVar('request_context')
+parent_header = cv.ContextVar('parent_header', default=None)
 
-def set_request_context(ctx):
+def set_request_context(ctx, parent=None):
     request_context.set(ctx)
+    parent_header.set(parent)
 
 def get_request_context():
     return request_context.get()
+
+def get_parent_header():
+    return parent_header.get()
         )"), context_module.attr("__dict__"));
 
         return context_module;
@@ -290,8 +345,72 @@ def get_request_context():
 
     py::module get_request_context_module()
     {
-        static py::module rc_module = make_request_context_module();
-        return rc_module;
+        static xinterpreter_singleton context_module("request_context", make_request_context_module);
+        return py::reinterpret_borrow<py::module>(context_module.get());
+    }
+
+    namespace
+    {
+        xeus::xrequest_context empty_request_context{};
+    }
+
+    const xeus::xrequest_context& get_current_request_context() noexcept
+    {
+        // Context variables are per thread: when the debugger sends some Python
+        // code to execute, or when a thread started by a cell writes to stdout,
+        // set_request_context has not been called on the current thread and the
+        // context variable is empty. The variable is read with the C API: there
+        // is no Python frame, and reading an unset variable does not raise.
+        try
+        {
+            static xinterpreter_singleton variable("request_context.request_context", []() -> py::object {
+                return get_request_context_module().attr("request_context");
+            });
+            PyObject* value = nullptr;
+            if (PyContextVar_Get(variable.get().ptr(), nullptr, &value) < 0 || value == nullptr)
+            {
+                PyErr_Clear();
+                return empty_request_context;
+            }
+            py::object res = py::reinterpret_steal<py::object>(value);
+            return *(res.cast<xeus::xrequest_context*>());
+        }
+        catch (std::exception&)
+        {
+            return empty_request_context;
+        }
+    }
+
+    void set_current_request_context(const xeus::xrequest_context& context)
+    {
+        // The Python parent header is built once per request, get_parent
+        // is called for every message sent by widget libraries.
+        get_request_context_module().attr("set_request_context")(context, make_parent_header(context));
+    }
+
+    py::dict make_parent_header(const xeus::xrequest_context& context)
+    {
+        return py::dict(py::arg("header") = context.header().get<py::object>());
+    }
+
+    py::object get_cached_parent_header()
+    {
+        static xinterpreter_singleton variable("request_context.parent_header", []() -> py::object {
+            return get_request_context_module().attr("parent_header");
+        });
+        PyObject* value = nullptr;
+        if (PyContextVar_Get(variable.get().ptr(), nullptr, &value) < 0)
+        {
+            throw py::error_already_set();
+        }
+        py::object parent = py::reinterpret_steal<py::object>(value);
+        // The parent header is not cached when the request context has been
+        // set outside of the interpreter, e.g. from the control thread.
+        if (!parent || parent.is_none())
+        {
+            parent = py::dict(py::arg("header") = get_kernel_interpreter().parent_header().get<py::object>());
+        }
+        return parent;
     }
 }
 
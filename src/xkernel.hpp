@@ -11,6 +11,8 @@
 #ifndef XPYT_KERNEL_HPP
 #define XPYT_KERNEL_HPP
 
+#include "xeus/xrequest_context.hpp"
+
 #include "pybind11/pybind11.h"
 
 namespace py = pybind11;
@@ -20,6 +22,19 @@ namespace xpyt
     py::module get_kernel_module(bool raw_mode = false);
 
     py::module get_request_context_module();
+
+    // Request context of the calling thread. Threads started by user code and
+    // the control thread have not set any, an empty context is returned.
+    // Must be called with the GIL held.
+    const xeus::xrequest_context& get_current_request_context() noexcept;
+
+    // Sets the request context of the calling thread and caches its Python
+    // parent header. Must be called with the GIL held.
+    void set_current_request_context(const xeus::xrequest_context& context);
+
+    // Python parent header cached in the request context
+    py::dict make_parent_header(const xeus::xrequest_context& context);
+    py::object get_cached_parent_header();
 }
 
 #endif
@@ -0,0 +1,115 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+
+#include "xkernel_host.hpp"
+
+#if XPYT_HAS_KERNEL_HOST
+#include "pybind11/subinterpreter.h"
+#endif
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+#if XPYT_HAS_KERNEL_HOST
+    namespace
+    {
+        struct kernel_thread
+        {
+            std::thread m_thread;
+            std::shared_ptr<std::atomic<bool>> m_done;
+        };
+
+        // Joins the threads of the kernels that have been shut down
+        void join_kernel_threads(std::vector<kernel_thread>& threads, bool wait)
+        {
+            auto it = std::remove_if(threads.begin(), threads.end(), [wait](kernel_thread& kernel)
+            {
+                if (!wait && !*kernel.m_done)
+                {
+                    return false;
+                }
+                kernel.m_thread.join();
+                return true;
+            });
+            threads.erase(it, threads.end());
+        }
+    }
+
+    void run_kernel_host(const std::string& fifo_path, const kernel_starter& start_kernel)
+    {
+        std::clog << "Kernel host waiting for connection files on " << fifo_path << std::endl;
+
+        // The GIL of the main interpreter is only needed to create the
+        // subinterpreters, each kernel then runs under its own GIL.
+        py::gil_scoped_release release;
+        std::vector<kernel_thread> threads;
+        try
+        {
+            read_connection_files(fifo_path, [&start_kernel, &threads](const std::string& connection_filename)
+            {
+                join_kernel_threads(threads, false);
+
+                py::subinterpreter sub = []()
+                {
+                    py::gil_scoped_acquire acquire;
+                    return py::subinterpreter::create();
+                }();
+
+                auto done = std::make_shared<std::atomic<bool>>(false);
+                std::thread thread([sub = std::move(sub), start_kernel, connection_filename, done]() mutable
+                {
+                    {
+                        py::subinterpreter_scoped_activate activate(sub);
+                        try
+                        {
+                            start_kernel(connection_filename);
+                        }
+                        catch (std::exception& e)
+                        {
+                            std::clog << "Kernel for " << connection_filename << " failed: " << e.what() << std::endl;
+                        }
+                    }
+                    *done = true;
+                });
+                threads.push_back({std::move(thread), std::move(done)});
+
+                std::clog << "Started kernel for " << connection_filename << std::endl;
+                return true;
+            });
+        }
+        catch (...)
+        {
+            // The subinterpreters must be destroyed before the main one
+            join_kernel_threads(threads, true);
+            throw;
+        }
+        join_kernel_threads(threads, true);
+    }
+#else
+    void run_kernel_host(const std::string&, const kernel_starter&)
+    {
+        throw std::runtime_error("The kernel host requires a Python and a pybind11 with subinterpreter support");
+    }
+#endif
+}
@@ -0,0 +1,44 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_KERNEL_HOST_HPP
+#define XPYT_KERNEL_HOST_HPP
+
+#include <functional>
+#include <string>
+
+#include "pybind11/pybind11.h"
+
+#include "xfork_server.hpp"
+
+#if XPYT_HAS_FORK_SERVER && defined(PYBIND11_HAS_SUBINTERPRETER_SUPPORT)
+    #define XPYT_HAS_KERNEL_HOST 1
+#else
+    #define XPYT_HAS_KERNEL_HOST 0
+#endif
+
+namespace xpyt
+{
+    using kernel_starter = std::function<void(const std::string&)>;
+
+    // Runs a kernel host: a kernel is started for every connection file path
+    // written to the FIFO, one per line, in a subinterpreter with its own GIL
+    // (PEP 684) running on its own thread. start_kernel is called with the
+    // subinterpreter activated and returns when the kernel is shut down.
+    //
+    // Kernels of the host share the process: they cannot be interrupted with
+    // signals, and extension modules that do not support subinterpreters
+    // cannot be imported in them. Only returns, by throwing, when the FIFO
+    // cannot be read, once the running kernels have been shut down. Must be
+    // called with the GIL of the main interpreter held.
+    void run_kernel_host(const std::string& fifo_path, const kernel_starter& start_kernel);
+}
+
+#endif
@@ -0,0 +1,324 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xinternal_utils.hpp"
+#include "xmemory.hpp"
+
+#if !defined(XPYT_EMSCRIPTEN_WASM_BUILD) && (defined(__unix__) || defined(__APPLE__))
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        // Number of reports kept in the history
+        constexpr std::size_t history_size = 100;
+
+        nl::json make_delta(std::size_t before, std::size_t after)
+        {
+            return {
+                {"before", before},
+                {"after", after},
+                {"delta", static_cast<std::int64_t>(after) - static_cast<std::int64_t>(before)}
+            };
+        }
+
+        std::size_t allocated_blocks()
+        {
+            return py::module::import("sys").attr("getallocatedblocks")().cast<std::size_t>();
+        }
+
+        bool tracemalloc_is_tracing()
+        {
+            return py::module::import("tracemalloc").attr("is_tracing")().cast<bool>();
+        }
+    }
+
+    std::size_t get_current_rss()
+    {
+#if defined(XPYT_EMSCRIPTEN_WASM_BUILD)
+        return 0;
+#elif defined(__linux__)
+        // Second field of statm, in pages
+        std::ifstream statm("/proc/self/statm");
+        std::size_t size = 0;
+        std::size_t resident = 0;
+        if (!(statm >> size >> resident))
+        {
+            return 0;
+        }
+        return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+        mach_task_basic_info_data_t info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+        {
+            return 0;
+        }
+        return static_cast<std::size_t>(info.resident_size);
+#else
+        return 0;
+#endif
+    }
+
+    std::size_t get_peak_rss()
+    {
+#if !defined(XPYT_EMSCRIPTEN_WASM_BUILD) && (defined(__unix__) || defined(__APPLE__))
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#if defined(__APPLE__)
+        // Reported in bytes on macOS, in kilobytes elsewhere
+        return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+        return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+        return 0;
+#endif
+    }
+
+    /**********************************
+     * xmemory_tracker implementation *
+     **********************************/
+
+    xmemory_tracker::xmemory_tracker()
+        : m_enabled(false)
+        , m_trace_allocations(false)
+        , m_started_tracemalloc(false)
+        , m_top_allocations(10)
+        , m_running(false)
+        , m_rss_before(0)
+        , m_blocks_before(0)
+        , m_traced_before(0)
+    {
+        if (const char* value = std::getenv("XPYTHON_MEMORY_TRACKING"))
+        {
+            std::string mode(value);
+            if (mode == "tracemalloc")
+            {
+                m_enabled = true;
+                m_trace_allocations = true;
+            }
+            else if (mode != "" && mode != "0")
+            {
+                m_enabled = true;
+            }
+        }
+    }
+
+    void xmemory_tracker::enable(bool trace_allocations, std::size_t top_allocations)
+    {
+        if (m_trace_allocations && !trace_allocations && m_started_tracemalloc)
+        {
+            py::module::import("tracemalloc").attr("stop")();
+            m_started_tracemalloc = false;
+        }
+
+        m_enabled = true;
+        m_trace_allocations = trace_allocations;
+        m_top_allocations = top_allocations;
+    }
+
+    void xmemory_tracker::disable()
+    {
+        if (m_started_tracemalloc)
+        {
+            py::module::import("tracemalloc").attr("stop")();
+            m_started_tracemalloc = false;
+        }
+
+        m_enabled = false;
+        m_trace_allocations = false;
+        m_running = false;
+        m_snapshot_before = py::object();
+    }
+
+    bool xmemory_tracker::enabled() const
+    {
+        return m_enabled;
+    }
+
+    void xmemory_tracker::begin()
+    {
+        if (!m_enabled || m_running)
+        {
+            return;
+        }
+
+        m_snapshot_before = py::object();
+        if (m_trace_allocations)
+        {
+            try
+            {
+                // tracemalloc is only stopped by disable when it was started
+                // here, tracing enabled by user code is left untouched.
+                py::module tracemalloc = py::module::import("tracemalloc");
+                if (!tracemalloc.attr("is_tracing")().cast<bool>())
+                {
+                    tracemalloc.attr("start")();
+                    m_started_tracemalloc = true;
+                }
+
+                if (py::hasattr(tracemalloc, "reset_peak"))
+                {
+                    tracemalloc.attr("reset_peak")();
+                }
+                py::object snapshot = tracemalloc.attr("take_snapshot")();
+                m_traced_before = tracemalloc.attr("get_traced_memory")().cast<py::tuple>()[0].cast<std::size_t>();
+                m_snapshot_before = snapshot;
+            }
+            catch (std::exception&)
+            {
+                // A failure of the accounting must not fail the execution,
+                // the traced allocations are not reported for this cell
+                m_snapshot_before = py::object();
+            }
+        }
+
+        m_blocks_before = allocated_blocks();
+        m_rss_before = get_current_rss();
+        m_owner = std::this_thread::get_id();
+        m_running = true;
+    }
+
+    nl::json xmemory_tracker::end(int execution_count)
+    {
+        if (!m_running || m_owner != std::this_thread::get_id())
+        {
+            return nl::json();
+        }
+        m_running = false;
+
+        nl::json report;
+        report["execution_count"] = execution_count;
+
+        std::size_t rss_after = get_current_rss();
+        if (rss_after != 0)
+        {
+            report["rss"] = make_delta(m_rss_before, rss_after);
+            report["peak_rss"] = get_peak_rss();
+        }
+        report["allocated_blocks"] = make_delta(m_blocks_before, allocated_blocks());
+
+        if (m_snapshot_before && tracemalloc_is_tracing())
+        {
+            add_traced_allocations(report);
+        }
+        m_snapshot_before = py::object();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_history.push_back(report);
+        if (m_history.size() > history_size)
+        {
+            m_history.pop_front();
+        }
+        return report;
+    }
+
+    nl::json xmemory_tracker::last_report() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_history.empty() ? nl::json() : m_history.back();
+    }
+
+    nl::json xmemory_tracker::history() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        nl::json res = nl::json::array();
+        for (const auto& report : m_history)
+        {
+            res.push_back(report);
+        }
+        return res;
+    }
+
+    void xmemory_tracker::add_traced_allocations(nl::json& report)
+    {
+        try
+        {
+            py::module tracemalloc = py::module::import("tracemalloc");
+            py::tuple traced = tracemalloc.attr("get_traced_memory")();
+
+            // Allocations of tracemalloc itself are not reported
+            py::list filters;
+            filters.append(tracemalloc.attr("Filter")(false, tracemalloc.attr("__file__")));
+            py::object after = tracemalloc.attr("take_snapshot")().attr("filter_traces")(filters);
+            py::object before = m_snapshot_before.attr("filter_traces")(filters);
+
+            // Statistics are sorted by decreasing absolute size difference
+            nl::json sites = nl::json::array();
+            for (py::handle stat : after.attr("compare_to")(before, "lineno"))
+            {
+                std::int64_t size_diff = stat.attr("size_diff").cast<std::int64_t>();
+                if (sites.size() == m_top_allocations || size_diff == 0)
+                {
+                    break;
+                }
+
+                py::object frame = stat.attr("traceback")[py::int_(0)];
+                sites.push_back({
+                    {"filename", frame.attr("filename").cast<std::string>()},
+                    {"lineno", frame.attr("lineno").cast<int>()},
+                    {"size_diff", size_diff},
+                    {"count_diff", stat.attr("count_diff").cast<std::int64_t>()}
+                });
+            }
+
+            report["traced"] = make_delta(m_traced_before, traced[0].cast<std::size_t>());
+            report["traced"]["peak"] = traced[1].cast<std::size_t>();
+            report["top_allocations"] = std::move(sites);
+        }
+        catch (py::error_already_set&)
+        {
+            // A failure of the accounting must not fail the execution
+        }
+    }
+
+    xmemory_tracker& get_memory_tracker()
+    {
+        // The tracker may hold Python objects, each interpreter has its own,
+        // released when the interpreter is finalized.
+        return get_interpreter_local<xmemory_tracker>("memory_tracker");
+    }
+
+    void add_memory_report(nl::json& reply, nl::json report)
+    {
+        if (!report.is_null())
+        {
+            get_execution_report(reply)["memory"] = std::move(report);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_MEMORY_HPP
+#define XPYT_MEMORY_HPP
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    // Resident set size of the process in bytes, 0 when unavailable
+    std::size_t get_current_rss();
+
+    // Peak resident set size of the process in bytes, 0 when unavailable
+    std::size_t get_peak_rss();
+
+    /*******************************
+     * xmemory_tracker declaration *
+     *******************************/
+
+    // Records the memory usage of the process before and after each
+    // execution: resident set size, blocks allocated by the Python
+    // allocator and, optionally, the top allocation sites reported by
+    // tracemalloc. Tracking is disabled by default, it is enabled with the
+    // XPYTHON_MEMORY_TRACKING environment variable ("1", or "tracemalloc"
+    // to also trace allocations) or from the kernel object.
+    //
+    // Methods must be called with the GIL held.
+    class xmemory_tracker
+    {
+    public:
+
+        xmemory_tracker();
+
+        xmemory_tracker(const xmemory_tracker&) = delete;
+        xmemory_tracker& operator=(const xmemory_tracker&) = delete;
+
+        void enable(bool trace_allocations = false, std::size_t top_allocations = 10);
+        void disable();
+        bool enabled() const;
+
+        // Snapshot taken before running a cell. The memory of the process is
+        // not attributed to overlapping requests: while a request is tracked,
+        // the ones running on other threads, such as subshells, are not.
+        void begin();
+        // Report of the cell run since begin, also kept in the history
+        nl::json end(int execution_count);
+
+        nl::json last_report() const;
+        nl::json history() const;
+
+    private:
+
+        void add_traced_allocations(nl::json& report);
+
+        bool m_enabled;
+        bool m_trace_allocations;
+        bool m_started_tracemalloc;
+        std::size_t m_top_allocations;
+
+        bool m_running;
+        std::thread::id m_owner;
+        std::size_t m_rss_before;
+        std::size_t m_blocks_before;
+        std::size_t m_traced_before;
+        py::object m_snapshot_before;
+
+        mutable std::mutex m_mutex;
+        std::deque<nl::json> m_history;
+    };
+
+    // Tracker of the current interpreter, must be called with the GIL held
+    xmemory_tracker& get_memory_tracker();
+
+    // Adds the report returned by xmemory_tracker::end to the content of an
+    // execute_reply, nothing is added when tracking was disabled.
+    void add_memory_report(nl::json& reply, nl::json report);
+}
+
+#endif
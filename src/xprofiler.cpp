@@ -0,0 +1,493 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xinternal_utils.hpp"
+#include "xprofiler.hpp"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        std::string to_string(PyObject* str)
+        {
+            const char* res = str != nullptr ? PyUnicode_AsUTF8(str) : nullptr;
+            if (res == nullptr)
+            {
+                PyErr_Clear();
+                return "?";
+            }
+            return res;
+        }
+
+        double to_seconds(std::chrono::steady_clock::duration duration)
+        {
+            return std::chrono::duration<double>(duration).count();
+        }
+
+        std::string html_escape(const std::string& str)
+        {
+            std::string res;
+            res.reserve(str.size());
+            for (char c : str)
+            {
+                switch (c)
+                {
+                case '&': res += "&amp;"; break;
+                case '<': res += "&lt;"; break;
+                case '>': res += "&gt;"; break;
+                case '"': res += "&quot;"; break;
+                default: res += c; break;
+                }
+            }
+            return res;
+        }
+
+        std::string format_row(const nl::json& row)
+        {
+            std::size_t ncalls = row["ncalls"].get<std::size_t>();
+            double tottime = row["tottime"].get<double>();
+            double cumtime = row["cumtime"].get<double>();
+            char buffer[64];
+            std::snprintf(buffer, sizeof(buffer), "%9zu %8.3f %8.3f %8.3f %8.3f ",
+                          ncalls, tottime, tottime / double(ncalls), cumtime, cumtime / double(ncalls));
+            return buffer + row["label"].get<std::string>();
+        }
+
+        std::string format_text(const nl::json& profile, std::size_t limit)
+        {
+            char summary[128];
+            std::snprintf(summary, sizeof(summary), "%zu function calls in %.3f seconds",
+                          profile["total_calls"].get<std::size_t>(), profile["total_time"].get<double>());
+
+            std::string res = summary;
+            res += "\n\n   Ordered by: " + profile["sort"].get<std::string>() + "\n\n";
+            res += "   ncalls  tottime  percall  cumtime  percall filename:lineno(function)\n";
+
+            const nl::json& functions = profile["functions"];
+            for (std::size_t i = 0; i < std::min(limit, functions.size()); ++i)
+            {
+                res += format_row(functions[i]) + "\n";
+            }
+            return res;
+        }
+
+        std::string format_html(const nl::json& profile, std::size_t limit)
+        {
+            char summary[128];
+            std::snprintf(summary, sizeof(summary), "%zu function calls in %.3f seconds, ordered by ",
+                          profile["total_calls"].get<std::size_t>(), profile["total_time"].get<double>());
+
+            std::string res = "<table>\n<caption>" + std::string(summary) + profile["sort"].get<std::string>() + "</caption>\n";
+            res += "<thead><tr><th>ncalls</th><th>tottime</th><th>percall</th><th>cumtime</th><th>percall</th><th>filename:lineno(function)</th></tr></thead>\n<tbody>\n";
+
+            const nl::json& functions = profile["functions"];
+            for (std::size_t i = 0; i < std::min(limit, functions.size()); ++i)
+            {
+                const nl::json& row = functions[i];
+                std::size_t ncalls = row["ncalls"].get<std::size_t>();
+                double tottime = row["tottime"].get<double>();
+                double cumtime = row["cumtime"].get<double>();
+                char cells[160];
+                std::snprintf(cells, sizeof(cells), "<td>%zu</td><td>%.3f</td><td>%.3f</td><td>%.3f</td><td>%.3f</td>",
+                              ncalls, tottime, tottime / double(ncalls), cumtime, cumtime / double(ncalls));
+                res += "<tr>" + std::string(cells) + "<td>" + html_escape(row["label"].get<std::string>()) + "</td></tr>\n";
+            }
+            res += "</tbody>\n</table>";
+            return res;
+        }
+    }
+
+    std::string make_profile_label(const std::string& name, const std::string& filename, int lineno)
+    {
+        if (filename == "~")
+        {
+            return "{" + name + "}";
+        }
+        return filename + ":" + std::to_string(lineno) + "(" + name + ")";
+    }
+
+    /***********************************
+     * xprofiler::scope implementation *
+     ***********************************/
+
+    xprofiler::scope::scope(xprofiler& profiler)
+        : m_profiler(profiler)
+        , m_started(profiler.start())
+    {
+    }
+
+    xprofiler::scope::~scope()
+    {
+        if (m_started)
+        {
+            m_profiler.stop();
+        }
+    }
+
+    /****************************
+     * xprofiler implementation *
+     ****************************/
+
+    void xprofiler::request(const std::string& sort, std::size_t limit)
+    {
+        if (sort != "ncalls" && sort != "tottime" && sort != "cumtime" && sort != "name")
+        {
+            throw std::invalid_argument("Unknown sort key '" + sort + "', expected one of 'ncalls', 'tottime', 'cumtime' or 'name'");
+        }
+
+        m_requested = true;
+        m_sort = sort;
+        m_limit = limit;
+    }
+
+    nl::json xprofiler::take_mime_bundle()
+    {
+        if (!m_has_new_profile)
+        {
+            return nl::json();
+        }
+        m_has_new_profile = false;
+
+        return {
+            {"text/plain", format_text(m_last_profile, m_limit)},
+            {"text/html", format_html(m_last_profile, m_limit)},
+            {"application/vnd.xpython.profile+json", m_last_profile}
+        };
+    }
+
+    nl::json xprofiler::last_profile() const
+    {
+        return m_last_profile;
+    }
+
+    int xprofiler::profile(PyObject* /*obj*/, PyFrameObject* frame, int what, PyObject* arg)
+    {
+        xprofiler& profiler = get_profiler();
+        switch (what)
+        {
+        case PyTrace_CALL:
+        {
+#if PY_VERSION_HEX >= 0x03090000
+            PyCodeObject* code = PyFrame_GetCode(frame);
+            profiler.enter(code, reinterpret_cast<PyObject*>(code));
+            Py_DECREF(code);
+#else
+            profiler.enter(frame->f_code, reinterpret_cast<PyObject*>(frame->f_code));
+#endif
+            break;
+        }
+        case PyTrace_C_CALL:
+            // Bound builtin methods are created on each call, they are
+            // identified by their method definition instead
+            if (PyCFunction_Check(arg))
+            {
+                profiler.enter(reinterpret_cast<PyCFunctionObject*>(arg)->m_ml, arg);
+            }
+            else
+            {
+                profiler.enter(arg, arg);
+            }
+            break;
+        case PyTrace_RETURN:
+        case PyTrace_C_RETURN:
+        case PyTrace_C_EXCEPTION:
+            profiler.leave();
+            break;
+        default:
+            break;
+        }
+        return 0;
+    }
+
+    bool xprofiler::start()
+    {
+        if (!m_requested)
+        {
+            return false;
+        }
+        m_requested = false;
+
+        m_functions.clear();
+        m_nodes.clear();
+        m_nodes.push_back({nullptr, 0, duration_type::zero(), {}});
+        m_stack.clear();
+        m_code_objects.clear();
+
+        // A profile function set with sys.setprofile is restored afterwards
+        m_previous_profile = py::module::import("sys").attr("getprofile")();
+
+        m_running = true;
+        m_start = clock_type::now();
+        PyEval_SetProfile(&xprofiler::profile, nullptr);
+        return true;
+    }
+
+    void xprofiler::stop()
+    {
+        if (!m_running)
+        {
+            return;
+        }
+
+        PyEval_SetProfile(nullptr, nullptr);
+        m_running = false;
+        m_elapsed = clock_type::now() - m_start;
+
+        // Frames still running when the profile function was removed
+        while (!m_stack.empty())
+        {
+            leave();
+        }
+
+        try
+        {
+            if (!m_previous_profile.is_none())
+            {
+                py::module::import("sys").attr("setprofile")(m_previous_profile);
+            }
+        }
+        catch (py::error_already_set&)
+        {
+        }
+        m_previous_profile = py::object();
+
+        m_last_profile = to_json();
+        m_has_new_profile = true;
+
+        m_functions.clear();
+        m_nodes.clear();
+        m_code_objects.clear();
+    }
+
+    void xprofiler::enter(const void* key, PyObject* function)
+    {
+        function_stats& stats = get_stats(key, function);
+        ++stats.m_calls;
+        ++stats.m_active;
+
+        std::size_t parent = m_stack.empty() ? 0 : m_stack.back().m_node;
+        std::size_t node;
+        auto it = m_nodes[parent].m_children.find(key);
+        if (it == m_nodes[parent].m_children.end())
+        {
+            node = m_nodes.size();
+            m_nodes[parent].m_children.emplace(key, node);
+            m_nodes.push_back({key, parent, duration_type::zero(), {}});
+        }
+        else
+        {
+            node = it->second;
+        }
+
+        m_stack.push_back({node, clock_type::now(), duration_type::zero()});
+    }
+
+    void xprofiler::leave()
+    {
+        // Return from a frame entered before the profiler was started
+        if (m_stack.empty())
+        {
+            return;
+        }
+
+        stack_entry entry = m_stack.back();
+        m_stack.pop_back();
+
+        duration_type elapsed = clock_type::now() - entry.m_start;
+        duration_type self = elapsed - entry.m_children;
+
+        call_node& node = m_nodes[entry.m_node];
+        node.m_self += self;
+
+        // The cumulative time of recursive functions is only accounted
+        // when leaving the outermost call
+        function_stats& stats = m_functions[node.m_key];
+        stats.m_total += self;
+        if (--stats.m_active == 0)
+        {
+            stats.m_cumulative += elapsed;
+        }
+
+        if (!m_stack.empty())
+        {
+            m_stack.back().m_children += elapsed;
+        }
+    }
+
+    auto xprofiler::get_stats(const void* key, PyObject* function) -> function_stats&
+    {
+        auto it = m_functions.find(key);
+        if (it != m_functions.end())
+        {
+            return it->second;
+        }
+
+        function_stats& stats = m_functions[key];
+        if (PyCode_Check(function))
+        {
+            PyCodeObject* code = reinterpret_cast<PyCodeObject*>(function);
+#if PY_VERSION_HEX >= 0x030B0000
+            stats.m_name = to_string(code->co_qualname);
+#else
+            stats.m_name = to_string(code->co_name);
+#endif
+            stats.m_filename = to_string(code->co_filename);
+            stats.m_lineno = code->co_firstlineno;
+            m_code_objects.push_back(py::reinterpret_borrow<py::object>(function));
+        }
+        else if (PyCFunction_Check(function))
+        {
+            // Same names as the ones reported by cProfile
+            auto* cfunction = reinterpret_cast<PyCFunctionObject*>(function);
+            std::string method_name = cfunction->m_ml->ml_name;
+            PyObject* self = cfunction->m_self;
+            if (self != nullptr && PyModule_Check(self))
+            {
+                const char* module_name = PyModule_GetName(self);
+                if (module_name == nullptr)
+                {
+                    PyErr_Clear();
+                    module_name = "?";
+                }
+                stats.m_name = "built-in method " + std::string(module_name) + "." + method_name;
+            }
+            else if (self != nullptr)
+            {
+                stats.m_name = "method '" + method_name + "' of '" + Py_TYPE(self)->tp_name + "' objects";
+            }
+            else
+            {
+                stats.m_name = "built-in method " + method_name;
+            }
+            stats.m_filename = "~";
+        }
+        else
+        {
+            PyObject* qualname = PyObject_GetAttrString(function, "__qualname__");
+            stats.m_name = qualname != nullptr ? to_string(qualname) : std::string(Py_TYPE(function)->tp_name);
+            Py_XDECREF(qualname);
+            PyErr_Clear();
+            stats.m_filename = "~";
+            m_code_objects.push_back(py::reinterpret_borrow<py::object>(function));
+        }
+        return stats;
+    }
+
+    nl::json xprofiler::to_json() const
+    {
+        std::vector<const function_stats*> functions;
+        functions.reserve(m_functions.size());
+        std::size_t total_calls = 0;
+        for (const auto& function : m_functions)
+        {
+            functions.push_back(&function.second);
+            total_calls += function.second.m_calls;
+        }
+
+        std::sort(functions.begin(), functions.end(), [this](const function_stats* lhs, const function_stats* rhs)
+        {
+            if (m_sort == "ncalls")
+            {
+                return lhs->m_calls > rhs->m_calls;
+            }
+            else if (m_sort == "tottime")
+            {
+                return lhs->m_total > rhs->m_total;
+            }
+            else if (m_sort == "name")
+            {
+                return lhs->m_name < rhs->m_name;
+            }
+            return lhs->m_cumulative > rhs->m_cumulative;
+        });
+
+        nl::json rows = nl::json::array();
+        for (const function_stats* stats : functions)
+        {
+            rows.push_back({
+                {"label", make_profile_label(stats->m_name, stats->m_filename, stats->m_lineno)},
+                {"function", stats->m_name},
+                {"filename", stats->m_filename},
+                {"lineno", stats->m_lineno},
+                {"ncalls", stats->m_calls},
+                {"tottime", to_seconds(stats->m_total)},
+                {"cumtime", to_seconds(stats->m_cumulative)}
+            });
+        }
+
+        return {
+            {"sort", m_sort},
+            {"total_calls", total_calls},
+            {"total_time", to_seconds(m_elapsed)},
+            {"functions", std::move(rows)},
+            {"collapsed_stacks", collapsed_stacks()}
+        };
+    }
+
+    std::string xprofiler::collapsed_stacks() const
+    {
+        // One line per call path, with the time spent in the last function
+        // of the path in microseconds, as expected by flamegraph tools
+        std::string res;
+        std::vector<std::pair<std::size_t, std::string>> pending = {{0, std::string()}};
+        while (!pending.empty())
+        {
+            std::pair<std::size_t, std::string> current = std::move(pending.back());
+            pending.pop_back();
+
+            const call_node& node = m_nodes[current.first];
+            std::string path = std::move(current.second);
+            if (current.first != 0)
+            {
+                const function_stats& stats = m_functions.at(node.m_key);
+                std::string label = make_profile_label(stats.m_name, stats.m_filename, stats.m_lineno);
+                std::replace(label.begin(), label.end(), ';', ':');
+                path = path.empty() ? label : path + ";" + label;
+
+                std::int64_t weight = std::chrono::duration_cast<std::chrono::microseconds>(node.m_self).count();
+                if (weight > 0)
+                {
+                    res += path + " " + std::to_string(weight) + "\n";
+                }
+            }
+
+            for (const auto& child : node.m_children)
+            {
+                pending.emplace_back(child.second, path);
+            }
+        }
+        return res;
+    }
+
+    xprofiler& get_profiler()
+    {
+        // The profiler holds Python objects, each interpreter has its own,
+        // released when the interpreter is finalized.
+        return get_interpreter_local<xprofiler>("profiler");
+    }
+}
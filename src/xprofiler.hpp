@@ -0,0 +1,150 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_PROFILER_HPP
+#define XPYT_PROFILER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    // Label of a function in profiles, in the format of the pstats module:
+    // filename:lineno(name), or {name} for builtins whose filename is "~"
+    std::string make_profile_label(const std::string& name, const std::string& filename, int lineno);
+
+    /*************************
+     * xprofiler declaration *
+     *************************/
+
+    // Deterministic profiler of a cell, the native counterpart of %%prun
+    // for the raw interpreter. Calls are recorded with a C profile
+    // function installed with PyEval_SetProfile and aggregated in a call
+    // tree, from which the per-function statistics and the collapsed
+    // stacks of a flamegraph are built.
+    //
+    // Only the thread running the cell is profiled. Methods must be called
+    // with the GIL held.
+    class xprofiler
+    {
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+        using duration_type = clock_type::duration;
+
+        // Profiles the execution of the next cell, if requested, for the
+        // lifetime of the scope
+        class scope
+        {
+        public:
+
+            explicit scope(xprofiler& profiler);
+            ~scope();
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+        private:
+
+            xprofiler& m_profiler;
+            bool m_started;
+        };
+
+        xprofiler() = default;
+
+        xprofiler(const xprofiler&) = delete;
+        xprofiler& operator=(const xprofiler&) = delete;
+
+        // Requests the profiling of the next cell. sort is one of "ncalls",
+        // "tottime", "cumtime" or "name", limit is the number of rows of
+        // the published table.
+        void request(const std::string& sort, std::size_t limit);
+
+        // Mime bundle of the last profile, and forgets it. Returns null
+        // when no profile was recorded since the last call.
+        nl::json take_mime_bundle();
+
+        // Statistics of the last profile, null when no cell was profiled
+        nl::json last_profile() const;
+
+    private:
+
+        struct function_stats
+        {
+            std::string m_name;
+            std::string m_filename;
+            int m_lineno = 0;
+            std::size_t m_calls = 0;
+            std::size_t m_active = 0;
+            duration_type m_total = duration_type::zero();
+            duration_type m_cumulative = duration_type::zero();
+        };
+
+        struct call_node
+        {
+            const void* m_key;
+            std::size_t m_parent;
+            duration_type m_self;
+            std::unordered_map<const void*, std::size_t> m_children;
+        };
+
+        struct stack_entry
+        {
+            std::size_t m_node;
+            clock_type::time_point m_start;
+            duration_type m_children;
+        };
+
+        static int profile(PyObject* obj, PyFrameObject* frame, int what, PyObject* arg);
+
+        bool start();
+        void stop();
+
+        void enter(const void* key, PyObject* function);
+        void leave();
+        function_stats& get_stats(const void* key, PyObject* function);
+
+        nl::json to_json() const;
+        std::string collapsed_stacks() const;
+
+        bool m_requested = false;
+        std::string m_sort = "cumtime";
+        std::size_t m_limit = 30;
+
+        bool m_running = false;
+        py::object m_previous_profile;
+        clock_type::time_point m_start;
+        duration_type m_elapsed = duration_type::zero();
+
+        std::unordered_map<const void*, function_stats> m_functions;
+        std::vector<call_node> m_nodes;
+        std::vector<stack_entry> m_stack;
+        // Keeps the code objects alive so that their addresses are not reused
+        std::vector<py::object> m_code_objects;
+
+        nl::json m_last_profile;
+        bool m_has_new_profile = false;
+    };
+
+    // Profiler of the current interpreter, must be called with the GIL held
+    xprofiler& get_profiler();
+}
+
+#endif
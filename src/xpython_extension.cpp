@@ -33,6 +33,7 @@
 #include "xeus-python/xinterpreter.hpp"
 #include "xeus-python/xinterpreter_raw.hpp"
 #include "xeus-python/xdebugger.hpp"
+#include "xeus-python/xshell_runner.hpp"
 #include "xeus-python/xutils.hpp"
 
 namespace py = pybind11;
@@ -66,6 +67,12 @@ void launch(const py::list args_list)
     signal(SIGINT, xpyt::sigkill_handler);
 
     bool raw_mode = xpyt::extract_option("-r", "--raw", argc, argv.data());
+
+    // Dispatching comm messages while a cell is running
+    bool concurrent_comms = xpyt::extract_option("", "--concurrent-comms", argc, argv.data());
+    xeus::xkernel::server_builder make_server = concurrent_comms
+        ? xeus::xkernel::server_builder(xpyt::make_concurrent_server)
+        : xeus::xkernel::server_builder(xeus::make_xserver_shell_main);
     std::string connection_filename = xeus::extract_filename(argc, argv.data());
 
     std::unique_ptr<xeus::xcontext> context = xeus::make_zmq_context();
@@ -100,7 +107,7 @@ void launch(const py::list args_list)
                              xeus::get_user_name(),
                              std::move(context),
                              std::move(interpreter),
-                             xeus::make_xserver_shell_main,
+                             make_server,
                              std::move(hist),
                              xeus::make_console_logger(xeus::xlogger::msg_type,
                                                        xeus::make_file_logger(xeus::xlogger::content, "xeus.log")),
@@ -119,7 +126,7 @@ void launch(const py::list args_list)
         xeus::xkernel kernel(xeus::get_user_name(),
                              std::move(context),
                              std::move(interpreter),
-                             xeus::make_xserver_shell_main,
+                             make_server,
                              std::move(hist),
                              nullptr,
                              xpyt::make_python_debugger);
@@ -147,7 +154,11 @@ void launch(const py::list args_list)
     }
 }
 
+#if PYBIND11_VERSION_HEX >= 0x020D0000
+PYBIND11_MODULE(xpython_extension, m, py::mod_gil_not_used())
+#else
 PYBIND11_MODULE(xpython_extension, m)
+#endif
 {
     m.doc() = "Xeus-python kernel launcher";
     m.def("launch", launch, py::arg("args_list"), "Launch the Jupyter kernel");
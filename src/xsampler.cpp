@@ -0,0 +1,408 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xprofiler.hpp"
+#include "xsampler.hpp"
+
+#if XPYT_HAS_NATIVE_SAMPLING
+#include <csignal>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#endif
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        using clock_type = std::chrono::steady_clock;
+
+        std::string join_stack(const std::vector<std::string>& frames)
+        {
+            std::string res;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+            {
+                std::string frame = *it;
+                std::replace(frame.begin(), frame.end(), ';', ':');
+                res += res.empty() ? frame : ";" + frame;
+            }
+            return res;
+        }
+
+        std::string collapse(const std::map<std::string, std::size_t>& stacks)
+        {
+            std::string res;
+            for (const auto& stack : stacks)
+            {
+                res += stack.first + " " + std::to_string(stack.second) + "\n";
+            }
+            return res;
+        }
+
+        // Python stack of the thread, from the outermost frame. Must be
+        // called with the GIL held.
+        std::string python_stack(unsigned long thread_ident)
+        {
+            py::int_ thread_id(thread_ident);
+            py::dict frames = py::module::import("sys").attr("_current_frames")();
+            if (!frames.contains(thread_id))
+            {
+                // The thread is not running Python code, e.g. the main
+                // thread waiting for the next request
+                return "(idle)";
+            }
+
+            std::vector<std::string> labels;
+            py::object frame = frames[thread_id];
+            while (!frame.is_none())
+            {
+                py::object code = frame.attr("f_code");
+                py::object name = py::hasattr(code, "co_qualname") ? code.attr("co_qualname") : code.attr("co_name");
+                labels.push_back(make_profile_label(name.cast<std::string>(),
+                                                    code.attr("co_filename").cast<std::string>(),
+                                                    code.attr("co_firstlineno").cast<int>()));
+                frame = frame.attr("f_back");
+            }
+            return join_stack(labels);
+        }
+
+#if XPYT_HAS_NATIVE_SAMPLING
+        constexpr int max_native_frames = 128;
+        void* native_frames[max_native_frames];
+        std::atomic<int> native_depth(0);
+        std::atomic<bool> native_ready(false);
+
+        // A signal that was not handled before a sample timed out is still
+        // pending, the previous disposition is only restored once every
+        // signal sent was handled. SIG_DFL would terminate the process.
+        std::atomic<unsigned> native_sent(0);
+        std::atomic<unsigned> native_handled(0);
+        std::atomic<bool> native_restore(false);
+        struct sigaction native_previous;
+
+        // Async-signal-safe, called by the handler and the sampler
+        void restore_native_disposition()
+        {
+            bool expected = true;
+            if (native_sent == native_handled && native_restore.compare_exchange_strong(expected, false))
+            {
+                sigaction(SIGPROF, &native_previous, nullptr);
+            }
+        }
+
+        void native_signal_handler(int)
+        {
+            native_depth = backtrace(native_frames, max_native_frames);
+            native_ready = true;
+            ++native_handled;
+            restore_native_disposition();
+        }
+
+        // The thread serving the shell, which blocks SIGPROF outside of the
+        // requests, and whether it is running one
+        pthread_t shell_thread;
+        std::atomic<bool> shell_thread_blocked(false);
+        std::atomic<bool> shell_thread_running(false);
+
+        void set_sigprof_blocked(bool blocked)
+        {
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGPROF);
+            pthread_sigmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &set, nullptr);
+        }
+
+        std::string native_symbol(void* address)
+        {
+            Dl_info info;
+            if (dladdr(address, &info) == 0)
+            {
+                return "??";
+            }
+
+            if (info.dli_sname != nullptr)
+            {
+                int status = 0;
+                char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+                std::string res = status == 0 ? demangled : info.dli_sname;
+                std::free(demangled);
+                return res;
+            }
+
+            // Symbols that are not exported are reported as their shared
+            // object, so that samples are not split by instruction address
+            std::string object = info.dli_fname != nullptr ? info.dli_fname : "??";
+            return "[" + object.substr(object.find_last_of('/') + 1) + "]";
+        }
+
+        /*******************************
+         * xnative_sampler declaration *
+         *******************************/
+
+        // Installs a SIGPROF handler recording the native stack of the
+        // thread receiving the signal, for the lifetime of the sampler
+        class xnative_sampler
+        {
+        public:
+
+            explicit xnative_sampler(pthread_t thread);
+            ~xnative_sampler();
+
+            xnative_sampler(const xnative_sampler&) = delete;
+            xnative_sampler& operator=(const xnative_sampler&) = delete;
+
+            // Collapsed native stack of the thread, empty on failure
+            std::string sample();
+
+        private:
+
+            pthread_t m_thread;
+        };
+
+        /**********************************
+         * xnative_sampler implementation *
+         **********************************/
+
+        xnative_sampler::xnative_sampler(pthread_t thread)
+            : m_thread(thread)
+        {
+            // The first call of backtrace loads libgcc, which is not safe
+            // from a signal handler
+            void* warmup[1];
+            backtrace(warmup, 1);
+
+            struct sigaction action = {};
+            action.sa_handler = native_signal_handler;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+
+            // When the disposition of a previous sampler is still to be
+            // restored, the handler is already installed and the saved
+            // disposition is the one to restore
+            if (native_restore.exchange(false))
+            {
+                sigaction(SIGPROF, &action, nullptr);
+            }
+            else
+            {
+                sigaction(SIGPROF, &action, &native_previous);
+            }
+        }
+
+        xnative_sampler::~xnative_sampler()
+        {
+            native_restore = true;
+            restore_native_disposition();
+        }
+
+        std::string xnative_sampler::sample()
+        {
+            if (shell_thread_blocked && pthread_equal(m_thread, shell_thread) && !shell_thread_running)
+            {
+                // Waiting for the next request or for input, with SIGPROF
+                // blocked
+                return "(idle)";
+            }
+
+            native_ready = false;
+            ++native_sent;
+            if (pthread_kill(m_thread, SIGPROF) != 0)
+            {
+                --native_sent;
+                return std::string();
+            }
+
+            auto deadline = clock_type::now() + std::chrono::milliseconds(100);
+            while (!native_ready)
+            {
+                if (clock_type::now() > deadline)
+                {
+                    return std::string();
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            // The first two frames are the signal handler and the signal
+            // trampoline
+            std::vector<std::string> labels;
+            for (int i = 2; i < native_depth; ++i)
+            {
+                labels.push_back(native_symbol(native_frames[i]));
+            }
+            return join_stack(labels);
+        }
+#endif
+    }
+
+    nl::json sample_main_thread(std::chrono::duration<double> duration, double rate, bool native)
+    {
+        auto interval = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1.0 / rate));
+
+        unsigned long main_thread_id = 0;
+        {
+            py::gil_scoped_acquire acquire;
+            main_thread_id = py::module::import("threading").attr("main_thread")().attr("ident").cast<unsigned long>();
+        }
+
+#if XPYT_HAS_NATIVE_SAMPLING
+        // The thread identifier of the threading module is the pthread_t
+        // of the thread on POSIX platforms
+        std::unique_ptr<xnative_sampler> native_sampler;
+        if (native)
+        {
+            native_sampler = std::make_unique<xnative_sampler>(static_cast<pthread_t>(main_thread_id));
+        }
+#else
+        native = false;
+#endif
+
+        std::map<std::string, std::size_t> python_stacks;
+        std::map<std::string, std::size_t> native_stacks;
+        std::size_t samples = 0;
+        clock_type::duration gil_wait = clock_type::duration::zero();
+
+        auto start = clock_type::now();
+        auto deadline = start + std::chrono::duration_cast<clock_type::duration>(duration);
+        for (auto next = start; next < deadline; next += interval)
+        {
+            std::this_thread::sleep_until(next);
+
+#if XPYT_HAS_NATIVE_SAMPLING
+            if (native_sampler)
+            {
+                std::string stack = native_sampler->sample();
+                if (!stack.empty())
+                {
+                    ++native_stacks[stack];
+                }
+            }
+#endif
+
+            auto wait_start = clock_type::now();
+            py::gil_scoped_acquire acquire;
+            auto acquired = clock_type::now();
+            gil_wait += acquired - wait_start;
+
+            ++python_stacks[python_stack(main_thread_id)];
+            ++samples;
+
+            // Ticks missed while waiting for the GIL are skipped
+            next = std::max(next, acquired - interval);
+        }
+
+        nl::json res = {
+            {"duration", std::chrono::duration<double>(clock_type::now() - start).count()},
+            {"rate", rate},
+            {"samples", samples},
+            {"gil_wait", std::chrono::duration<double>(gil_wait).count()},
+            {"collapsed_stacks", collapse(python_stacks)},
+            {"native_available", XPYT_HAS_NATIVE_SAMPLING == 1}
+        };
+        if (native)
+        {
+            res["native_collapsed_stacks"] = collapse(native_stacks);
+        }
+        return res;
+    }
+
+#if XPYT_HAS_NATIVE_SAMPLING
+    void block_native_sampling()
+    {
+        if (shell_thread_blocked)
+        {
+            return;
+        }
+
+        set_sigprof_blocked(true);
+        shell_thread = pthread_self();
+        shell_thread_blocked = true;
+    }
+
+    xnative_sampling_scope::xnative_sampling_scope()
+        : m_active(shell_thread_blocked && pthread_equal(pthread_self(), shell_thread))
+    {
+        if (m_active)
+        {
+            set_sigprof_blocked(false);
+            shell_thread_running = true;
+        }
+    }
+
+    xnative_sampling_scope::~xnative_sampling_scope()
+    {
+        // A signal sent after the flag is cleared stays pending until the
+        // next request
+        if (m_active)
+        {
+            shell_thread_running = false;
+            set_sigprof_blocked(true);
+        }
+    }
+
+    xnative_sampling_pause::xnative_sampling_pause()
+        : m_active(shell_thread_running && pthread_equal(pthread_self(), shell_thread))
+    {
+        if (m_active)
+        {
+            shell_thread_running = false;
+            set_sigprof_blocked(true);
+        }
+    }
+
+    xnative_sampling_pause::~xnative_sampling_pause()
+    {
+        if (m_active)
+        {
+            set_sigprof_blocked(false);
+            shell_thread_running = true;
+        }
+    }
+#else
+    void block_native_sampling()
+    {
+    }
+
+    xnative_sampling_scope::xnative_sampling_scope()
+        : m_active(false)
+    {
+    }
+
+    xnative_sampling_scope::~xnative_sampling_scope()
+    {
+    }
+
+    xnative_sampling_pause::xnative_sampling_pause()
+        : m_active(false)
+    {
+    }
+
+    xnative_sampling_pause::~xnative_sampling_pause()
+    {
+    }
+#endif
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_SAMPLER_HPP
+#define XPYT_SAMPLER_HPP
+
+#include <chrono>
+
+#include "nlohmann/json.hpp"
+
+#if defined(__GLIBC__) && !defined(XPYT_EMSCRIPTEN_WASM_BUILD)
+    #define XPYT_HAS_NATIVE_SAMPLING 1
+#else
+    #define XPYT_HAS_NATIVE_SAMPLING 0
+#endif
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    // Samples the stack of the main thread at the given rate, in Hz, for
+    // the given duration, and returns the collapsed stacks of the samples
+    // along with their count. Must be called from another thread, without
+    // holding the GIL.
+    //
+    // The Python stack is read with sys._current_frames, a sample is
+    // therefore taken when the main thread releases the GIL, which happens
+    // at least every switch interval while running Python code. The time
+    // spent waiting for the GIL is reported. When native is true and the
+    // platform supports it, the native stack of the main thread is also
+    // sampled, by sending SIGPROF to the main thread.
+    nl::json sample_main_thread(std::chrono::duration<double> duration, double rate, bool native);
+
+    // SIGPROF interrupts the poll of the shell socket, which the runner of
+    // xeus does not retry. The thread serving the shell blocks it when the
+    // kernel is configured, and only unblocks it in the scope of a request,
+    // the native stack of that thread is only sampled there.
+    void block_native_sampling();
+
+    class xnative_sampling_scope
+    {
+    public:
+
+        xnative_sampling_scope();
+        ~xnative_sampling_scope();
+
+        xnative_sampling_scope(const xnative_sampling_scope&) = delete;
+        xnative_sampling_scope& operator=(const xnative_sampling_scope&) = delete;
+
+    private:
+
+        bool m_active;
+    };
+
+    // Blocks SIGPROF again within the scope of a request, around the
+    // blocking zmq calls made on the thread serving the shell, such as the
+    // stdin request of input() and getpass(). The thread is sampled as idle.
+    class xnative_sampling_pause
+    {
+    public:
+
+        xnative_sampling_pause();
+        ~xnative_sampling_pause();
+
+        xnative_sampling_pause(const xnative_sampling_pause&) = delete;
+        xnative_sampling_pause& operator=(const xnative_sampling_pause&) = delete;
+
+    private:
+
+        bool m_active;
+    };
+}
+
+#endif
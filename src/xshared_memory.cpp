@@ -0,0 +1,163 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "xshared_memory.hpp"
+
+#if XPYT_HAS_SHARED_MEMORY
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xpyt
+{
+    namespace
+    {
+#if XPYT_HAS_SHARED_MEMORY
+        void write_segment(const std::string& name, const char* data, std::size_t size)
+        {
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+            if (fd == -1)
+            {
+                throw std::runtime_error("Could not create shared memory segment " + name + ": " + std::strerror(errno));
+            }
+
+            // mmap does not accept empty mappings
+            if (size != 0)
+            {
+                void* addr = MAP_FAILED;
+                if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+                {
+                    addr = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+
+                if (addr == MAP_FAILED)
+                {
+                    std::string error = std::strerror(errno);
+                    close(fd);
+                    shm_unlink(name.c_str());
+                    throw std::runtime_error("Could not map shared memory segment " + name + ": " + error);
+                }
+
+                std::memcpy(addr, data, size);
+                munmap(addr, size);
+            }
+            close(fd);
+        }
+
+        void unlink_segment(const std::string& name)
+        {
+            shm_unlink(name.c_str());
+        }
+#else
+        void write_segment(const std::string&, const char*, std::size_t)
+        {
+            throw std::runtime_error("Shared memory comm buffers are not supported on this platform");
+        }
+
+        void unlink_segment(const std::string&)
+        {
+        }
+#endif
+    }
+
+    /********************************
+     * xshm_registry implementation *
+     ********************************/
+
+    xshm_registry::~xshm_registry()
+    {
+        for (const auto& segment : m_segments)
+        {
+            unlink_segment(segment.first);
+        }
+    }
+
+    std::string xshm_registry::create(const char* data, std::size_t size, std::size_t ref_count)
+    {
+        std::string name;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // Names are kept short since macOS limits them to 31 characters
+#if XPYT_HAS_SHARED_MEMORY
+            name = "/xpyt-" + std::to_string(getpid()) + "-" + std::to_string(m_counter++);
+#else
+            name = "/xpyt-" + std::to_string(m_counter++);
+#endif
+        }
+
+        write_segment(name, data, size);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_segments[name] = ref_count;
+        return name;
+    }
+
+    void xshm_registry::release(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_segments.find(name);
+        if (it != m_segments.end() && --(it->second) == 0)
+        {
+            unlink_segment(name);
+            m_segments.erase(it);
+        }
+    }
+
+    bool xshm_registry::contains(const std::string& name) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_segments.find(name) != m_segments.end();
+    }
+
+    xshm_registry& get_shm_registry()
+    {
+        static xshm_registry registry;
+        return registry;
+    }
+
+#if XPYT_HAS_SHARED_MEMORY
+    py::bytes read_shared_memory(const std::string& name, std::size_t size)
+    {
+        if (size == 0)
+        {
+            return py::bytes();
+        }
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1)
+        {
+            throw std::runtime_error("Could not open shared memory segment " + name + ": " + std::strerror(errno));
+        }
+
+        void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            throw std::runtime_error("Could not map shared memory segment " + name + ": " + std::strerror(errno));
+        }
+
+        py::bytes res(static_cast<const char*>(addr), size);
+        munmap(addr, size);
+        return res;
+    }
+#else
+    py::bytes read_shared_memory(const std::string&, std::size_t)
+    {
+        throw std::runtime_error("Shared memory comm buffers are not supported on this platform");
+    }
+#endif
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_SHARED_MEMORY_HPP
+#define XPYT_SHARED_MEMORY_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "pybind11/pybind11.h"
+
+#if !defined(XPYT_EMSCRIPTEN_WASM_BUILD) && (defined(__unix__) || defined(__APPLE__))
+    #define XPYT_HAS_SHARED_MEMORY 1
+#else
+    #define XPYT_HAS_SHARED_MEMORY 0
+#endif
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    /*****************************
+     * xshm_registry declaration *
+     *****************************/
+
+    // Keeps track of the POSIX shared memory segments holding comm buffers.
+    // A segment is unlinked when its reference count drops to zero, that is
+    // when every frontend that received its handle released it. Remaining
+    // segments are unlinked when the registry is destroyed.
+    class xshm_registry
+    {
+    public:
+
+        xshm_registry() = default;
+        ~xshm_registry();
+
+        xshm_registry(const xshm_registry&) = delete;
+        xshm_registry& operator=(const xshm_registry&) = delete;
+
+        // Creates a new segment holding a copy of data and returns its name
+        std::string create(const char* data, std::size_t size, std::size_t ref_count = 1);
+        void release(const std::string& name);
+        bool contains(const std::string& name) const;
+
+    private:
+
+        mutable std::mutex m_mutex;
+        std::map<std::string, std::size_t> m_segments;
+        std::size_t m_counter = 0;
+    };
+
+    xshm_registry& get_shm_registry();
+
+    // Stand-in for a co-located frontend reading a segment
+    py::bytes read_shared_memory(const std::string& name, std::size_t size);
+}
+
+#endif
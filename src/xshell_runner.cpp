@@ -0,0 +1,823 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "zmq.hpp"
+
+#include "xeus/xeus_context.hpp"
+#include "xeus/xguid.hpp"
+#include "xeus/xmessage.hpp"
+
+#include "xeus-zmq/xcontrol_default_runner.hpp"
+#include "xeus-zmq/xserver_zmq_split.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xeus-python/xshell_runner.hpp"
+
+#include "xcompletion_worker.hpp"
+#include "xinternal_utils.hpp"
+
+namespace py = pybind11;
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    namespace
+    {
+        // Subshell whose thread is the calling one, if any
+        thread_local void* current_subshell = nullptr;
+
+        void poll_sockets(zmq::pollitem_t* items, int count, std::chrono::milliseconds timeout)
+        {
+            try
+            {
+                zmq::poll(items, count, timeout);
+            }
+            catch (zmq::error_t& e)
+            {
+                // Interrupted by a signal, the sockets are polled again
+                if (e.num() != EINTR)
+                {
+                    throw;
+                }
+            }
+        }
+
+        // Server sending the shell messages through the I/O thread of a
+        // shell_runner, the other channels are forwarded to the zmq server.
+        class routed_server final : public xeus::xserver
+        {
+        public:
+
+            routed_server(std::unique_ptr<xeus::xserver> server, shell_runner& runner)
+                : p_server(std::move(server))
+                , m_runner(runner)
+            {
+                p_server->register_shell_listener([this](xeus::xmessage msg) { notify_shell_listener(std::move(msg)); });
+                p_server->register_control_listener([this](xeus::xmessage msg) { notify_control_listener(std::move(msg)); });
+                p_server->register_stdin_listener([this](xeus::xmessage msg) { notify_stdin_listener(std::move(msg)); });
+                p_server->register_internal_listener([this](nl::json msg) { return notify_internal_listener(std::move(msg)); });
+            }
+
+        private:
+
+            xeus::xcontrol_messenger& get_control_messenger_impl() override
+            {
+                return p_server->get_control_messenger();
+            }
+
+            void send_shell_impl(xeus::xmessage msg) override
+            {
+                m_runner.send_shell(std::move(msg));
+            }
+
+            void send_control_impl(xeus::xmessage msg) override
+            {
+                p_server->send_control(std::move(msg));
+            }
+
+            void send_stdin_impl(xeus::xmessage msg) override
+            {
+                p_server->send_stdin(std::move(msg));
+            }
+
+            void publish_impl(xeus::xpub_message msg, xeus::channel c) override
+            {
+                p_server->publish(std::move(msg), c);
+            }
+
+            void start_impl(xeus::xpub_message msg) override
+            {
+                p_server->start(std::move(msg));
+            }
+
+            void abort_queue_impl(const listener& l, long polling_interval) override
+            {
+                m_runner.abort_queue(l, polling_interval);
+            }
+
+            void stop_impl() override
+            {
+                p_server->stop();
+            }
+
+            void update_config_impl(xeus::xconfiguration& config) const override
+            {
+                p_server->update_config(config);
+            }
+
+            std::unique_ptr<xeus::xserver> p_server;
+            shell_runner& m_runner;
+        };
+    }
+
+    class shell_runner::wakeup
+    {
+    public:
+
+        wakeup(zmq::context_t& context)
+            : m_sender(context, zmq::socket_type::pair)
+            , m_receiver(context, zmq::socket_type::pair)
+        {
+            std::string endpoint = "inproc://xpyt-shell-wakeup-" + xeus::new_xguid();
+            m_receiver.bind(endpoint);
+            m_sender.connect(endpoint);
+        }
+
+        // Called from any thread
+        void notify()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sender.send(zmq::message_t(), zmq::send_flags::dontwait);
+        }
+
+        // Called from the polling thread before it looks for work
+        void clear()
+        {
+            zmq::message_t msg;
+            while (m_receiver.recv(msg, zmq::recv_flags::dontwait))
+            {
+            }
+        }
+
+        zmq::pollitem_t poll_item()
+        {
+            return { static_cast<void*>(m_receiver), 0, ZMQ_POLLIN, 0 };
+        }
+
+    private:
+
+        std::mutex m_mutex;
+        zmq::socket_t m_sender;
+        zmq::socket_t m_receiver;
+    };
+
+    shell_runner::shell_runner(xeus::xcontext& context, std::chrono::milliseconds poll_interval)
+        : m_concurrent_types({"comm_msg",
+                              "complete_request",
+                              "history_request",
+                              "is_complete_request",
+                              "kernel_info_request"})
+        , m_responsive_types({"history_request",
+                              "is_complete_request",
+                              "kernel_info_request"})
+        , m_poll_interval(poll_interval)
+        , p_server(nullptr)
+        , p_main_wakeup(std::make_unique<wakeup>(context.get_wrapped_context<zmq::context_t>()))
+        , p_io_wakeup(std::make_unique<wakeup>(context.get_wrapped_context<zmq::context_t>()))
+        , m_stop_io(false)
+        , m_self(std::make_shared<shell_runner*>(this))
+        , m_busy(false)
+        , m_call_pending(false)
+        , m_in_concurrent_dispatch(false)
+    {
+    }
+
+    shell_runner::~shell_runner()
+    {
+        stop_subshells();
+        stop_io_thread();
+    }
+
+    void shell_runner::add_concurrent_message_type(const std::string& msg_type)
+    {
+        m_concurrent_types.insert(msg_type);
+    }
+
+    void shell_runner::set_server(xeus::xserver& server)
+    {
+        p_server = &server;
+    }
+
+    void shell_runner::run_impl()
+    {
+        start_io_thread();
+        m_responder.m_thread = std::thread(&shell_runner::run_subshell, this, std::ref(m_responder));
+
+        zmq::pollitem_t items[] = {
+            { nullptr, get_shell_controller_fd(), ZMQ_POLLIN, 0 },
+            p_main_wakeup->poll_item()
+        };
+
+        while (true)
+        {
+            // Wakeups notified from now on are not missed
+            p_main_wakeup->clear();
+
+            while (auto msg = next_message())
+            {
+                // The kernel core is shared with the responder and the
+                // subshell threads, it is only used with the GIL held.
+                py::gil_scoped_acquire acquire;
+                dispatch(std::move(msg.value()));
+            }
+
+            if (process_controller_messages())
+            {
+                break;
+            }
+
+            poll_sockets(&items[0], 2, m_poll_interval);
+        }
+
+        // The replies of the requests still queued by the subshells are
+        // sent before the I/O thread stops.
+        stop_subshells();
+        stop_io_thread();
+    }
+
+    bool shell_runner::process_controller_messages()
+    {
+        while (auto msg = read_controller(ZMQ_DONTWAIT))
+        {
+            std::string val{msg.value()};
+            if (val == "stop")
+            {
+                send_controller(std::move(val));
+                return true;
+            }
+            else
+            {
+                std::string rep = notify_internal_listener(std::move(val));
+                send_controller(std::move(rep));
+            }
+        }
+        return false;
+    }
+
+    std::optional<xeus::xmessage> shell_runner::next_message()
+    {
+        // Messages received while a request was running are processed
+        // before anything else to preserve the ordering.
+        if (!m_deferred.empty())
+        {
+            xeus::xmessage msg = std::move(m_deferred.front());
+            m_deferred.pop_front();
+            return msg;
+        }
+
+        std::lock_guard<std::mutex> lock(m_incoming_mutex);
+        if (!m_incoming.empty())
+        {
+            xeus::xmessage msg = std::move(m_incoming.front());
+            m_incoming.pop_front();
+            return msg;
+        }
+        return std::nullopt;
+    }
+
+    void shell_runner::dispatch(xeus::xmessage msg)
+    {
+        m_busy = true;
+        {
+            // Messages received before the busy flag was set are routed
+            // as if they had been received after.
+            std::lock_guard<std::mutex> lock(m_incoming_mutex);
+            auto responsive = std::stable_partition(m_incoming.begin(), m_incoming.end(),
+                                                    [this](const xeus::xmessage& m) { return !is_responsive(m); });
+            std::for_each(std::make_move_iterator(responsive),
+                          std::make_move_iterator(m_incoming.end()),
+                          [this](xeus::xmessage&& m) { post(m_responder, std::move(m)); });
+            m_incoming.erase(responsive, m_incoming.end());
+            if (!m_incoming.empty())
+            {
+                schedule_pending_call();
+            }
+        }
+
+        notify_shell_listener(std::move(msg));
+        m_busy = false;
+    }
+
+    void shell_runner::dispatch_concurrent(xeus::xmessage msg)
+    {
+        // The nested request sets its own request context, it is run in a
+        // copy of the current Python context so that the context of the
+        // running request is left untouched.
+        py::object context = py::reinterpret_steal<py::object>(PyContext_CopyCurrent());
+        if (!context || PyContext_Enter(context.ptr()) != 0)
+        {
+            throw py::error_already_set();
+        }
+
+        try
+        {
+            notify_shell_listener(std::move(msg));
+        }
+        catch (...)
+        {
+            PyContext_Exit(context.ptr());
+            throw;
+        }
+        PyContext_Exit(context.ptr());
+    }
+
+    bool shell_runner::is_concurrent(const xeus::xmessage& msg) const
+    {
+        std::string msg_type = msg.header().value("msg_type", "");
+        return m_concurrent_types.find(msg_type) != m_concurrent_types.end();
+    }
+
+    bool shell_runner::is_responsive(const xeus::xmessage& msg) const
+    {
+        std::string msg_type = msg.header().value("msg_type", "");
+        return m_responsive_types.find(msg_type) != m_responsive_types.end();
+    }
+
+    int shell_runner::pending_call(void* runner)
+    {
+        // The runner is destroyed on the main thread, where pending calls
+        // are run, it cannot be destroyed while the call runs.
+        std::unique_ptr<std::weak_ptr<shell_runner*>> token(static_cast<std::weak_ptr<shell_runner*>*>(runner));
+        std::shared_ptr<shell_runner*> alive = token->lock();
+        if (!alive)
+        {
+            return 0;
+        }
+
+        shell_runner* self = *alive;
+        self->m_call_pending = false;
+        try
+        {
+            self->process_concurrent_messages();
+        }
+        catch (py::error_already_set& e)
+        {
+            std::clog << "Error while dispatching a concurrent message: " << e.what() << std::endl;
+        }
+        catch (std::exception& e)
+        {
+            std::clog << "Error while dispatching a concurrent message: " << e.what() << std::endl;
+        }
+        return 0;
+    }
+
+    void shell_runner::schedule_pending_call()
+    {
+        // Py_AddPendingCall does not require the GIL. The call is not
+        // scheduled again until the previous one has been run.
+        if (!m_call_pending.exchange(true))
+        {
+            auto token = std::make_unique<std::weak_ptr<shell_runner*>>(m_self);
+            if (Py_AddPendingCall(&shell_runner::pending_call, token.get()) == 0)
+            {
+                token.release();
+            }
+            else
+            {
+                m_call_pending = false;
+            }
+        }
+    }
+
+    void shell_runner::process_concurrent_messages()
+    {
+        // The pending call may run after the request has completed, or
+        // from a handler dispatched by a previous pending call.
+        if (!m_busy || m_in_concurrent_dispatch)
+        {
+            return;
+        }
+
+        m_in_concurrent_dispatch = true;
+        try
+        {
+            while (true)
+            {
+                std::optional<xeus::xmessage> msg;
+                {
+                    std::lock_guard<std::mutex> lock(m_incoming_mutex);
+                    if (m_incoming.empty())
+                    {
+                        break;
+                    }
+                    msg = std::move(m_incoming.front());
+                    m_incoming.pop_front();
+                }
+
+                if (is_concurrent(msg.value()))
+                {
+                    dispatch_concurrent(std::move(msg.value()));
+                }
+                else
+                {
+                    m_deferred.push_back(std::move(msg.value()));
+                }
+            }
+        }
+        catch (...)
+        {
+            m_in_concurrent_dispatch = false;
+            throw;
+        }
+        m_in_concurrent_dispatch = false;
+    }
+
+    void shell_runner::send_shell(xeus::xmessage msg)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_outgoing_mutex);
+            m_outgoing.push_back(std::move(msg));
+        }
+        p_io_wakeup->notify();
+    }
+
+    void shell_runner::abort_queue(const xeus::xserver::listener& l, long polling_interval)
+    {
+        subshell* sub = static_cast<subshell*>(current_subshell);
+        while (true)
+        {
+            // Requests sent right before the failing one may not have
+            // been read by the I/O thread yet.
+            std::this_thread::sleep_for(std::chrono::milliseconds(polling_interval));
+
+            std::deque<xeus::xmessage> aborted;
+            if (sub != nullptr)
+            {
+                std::lock_guard<std::mutex> lock(sub->m_mutex);
+                aborted.swap(sub->m_queue);
+            }
+            else
+            {
+                aborted.swap(m_deferred);
+                std::lock_guard<std::mutex> lock(m_incoming_mutex);
+                std::move(m_incoming.begin(), m_incoming.end(), std::back_inserter(aborted));
+                m_incoming.clear();
+            }
+
+            if (aborted.empty())
+            {
+                break;
+            }
+            for (auto& msg : aborted)
+            {
+                l(std::move(msg));
+            }
+        }
+    }
+
+    void shell_runner::run_io()
+    {
+        zmq::pollitem_t items[] = {
+            { nullptr, get_shell_fd(), ZMQ_POLLIN, 0 },
+            p_io_wakeup->poll_item()
+        };
+
+        while (true)
+        {
+            p_io_wakeup->clear();
+            // The replies queued before the stop request are still sent
+            bool stop = m_stop_io;
+            send_outgoing_messages();
+            if (stop)
+            {
+                break;
+            }
+
+            // The file descriptor is edge triggered, sending messages may
+            // consume its notification. The socket must be drained before
+            // polling again.
+            while (auto msg = read_shell(ZMQ_DONTWAIT))
+            {
+                route(std::move(msg.value()));
+            }
+
+            poll_sockets(&items[0], 2, m_poll_interval);
+        }
+    }
+
+    void shell_runner::route(xeus::xmessage msg)
+    {
+        if (post_to_subshell(msg))
+        {
+            return;
+        }
+
+        if (m_busy && is_responsive(msg))
+        {
+            post(m_responder, std::move(msg));
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_incoming_mutex);
+            m_incoming.push_back(std::move(msg));
+        }
+        p_main_wakeup->notify();
+        if (m_busy)
+        {
+            schedule_pending_call();
+        }
+    }
+
+    void shell_runner::send_outgoing_messages()
+    {
+        std::deque<xeus::xmessage> outgoing;
+        {
+            std::lock_guard<std::mutex> lock(m_outgoing_mutex);
+            outgoing.swap(m_outgoing);
+        }
+        for (auto& msg : outgoing)
+        {
+            p_server->send_shell(std::move(msg));
+        }
+    }
+
+    void shell_runner::start_io_thread()
+    {
+        if (!m_io_thread.joinable())
+        {
+            m_stop_io = false;
+            m_io_thread = std::thread(&shell_runner::run_io, this);
+        }
+    }
+
+    void shell_runner::stop_io_thread()
+    {
+        if (m_io_thread.joinable())
+        {
+            m_stop_io = true;
+            p_io_wakeup->notify();
+            m_io_thread.join();
+        }
+    }
+
+    std::string shell_runner::create_subshell()
+    {
+        std::string subshell_id = xeus::new_xguid();
+        auto sub = std::make_unique<subshell>();
+        subshell& new_subshell = *sub;
+
+        std::lock_guard<std::mutex> lock(m_subshell_mutex);
+        sub->m_thread = std::thread(&shell_runner::run_subshell, this, std::ref(new_subshell));
+        m_subshells.emplace(subshell_id, std::move(sub));
+        return subshell_id;
+    }
+
+    bool shell_runner::delete_subshell(const std::string& subshell_id)
+    {
+        std::lock_guard<std::mutex> lock(m_subshell_mutex);
+        auto it = m_subshells.find(subshell_id);
+        if (it == m_subshells.end())
+        {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> subshell_lock(it->second->m_mutex);
+            it->second->m_stop = true;
+        }
+        it->second->m_cv.notify_one();
+        m_deleted_subshells.push_back(std::move(it->second));
+        m_subshells.erase(it);
+        return true;
+    }
+
+    std::vector<std::string> shell_runner::list_subshells() const
+    {
+        std::lock_guard<std::mutex> lock(m_subshell_mutex);
+        std::vector<std::string> res;
+        res.reserve(m_subshells.size());
+        for (const auto& entry : m_subshells)
+        {
+            res.push_back(entry.first);
+        }
+        return res;
+    }
+
+    bool shell_runner::post_to_subshell(xeus::xmessage& msg)
+    {
+        const nl::json& header = msg.header();
+        auto id = header.find("subshell_id");
+        if (id == header.end() || !id->is_string())
+        {
+            return false;
+        }
+
+        // Messages for unknown subshells are handled by the main shell
+        std::lock_guard<std::mutex> lock(m_subshell_mutex);
+        auto it = m_subshells.find(id->get<std::string>());
+        if (it == m_subshells.end())
+        {
+            return false;
+        }
+
+        post(*(it->second), std::move(msg));
+        return true;
+    }
+
+    void shell_runner::post(subshell& sub, xeus::xmessage msg)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sub.m_mutex);
+            sub.m_queue.push_back(std::move(msg));
+        }
+        sub.m_cv.notify_one();
+    }
+
+    void shell_runner::run_subshell(subshell& sub)
+    {
+        current_subshell = &sub;
+        while (true)
+        {
+            std::optional<xeus::xmessage> msg;
+            {
+                // A stopped subshell handles its queued messages before
+                // exiting, so that every request gets a reply.
+                std::unique_lock<std::mutex> lock(sub.m_mutex);
+                sub.m_cv.wait(lock, [&sub]() { return sub.m_stop || !sub.m_queue.empty(); });
+                if (sub.m_queue.empty())
+                {
+                    return;
+                }
+                msg = std::move(sub.m_queue.front());
+                sub.m_queue.pop_front();
+            }
+
+            // Request contexts are per thread, the outputs of the request
+            // are sent with the header of the subshell message.
+            try
+            {
+                py::gil_scoped_acquire acquire;
+                notify_shell_listener(std::move(msg.value()));
+            }
+            catch (std::exception& e)
+            {
+                std::clog << "Error while dispatching a subshell message: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    void shell_runner::stop_subshell(subshell& sub)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sub.m_mutex);
+            sub.m_stop = true;
+        }
+        sub.m_cv.notify_one();
+        if (sub.m_thread.joinable())
+        {
+            sub.m_thread.join();
+        }
+    }
+
+    void shell_runner::stop_subshells()
+    {
+        std::vector<std::unique_ptr<subshell>> subshells;
+        {
+            std::lock_guard<std::mutex> lock(m_subshell_mutex);
+            for (auto& entry : m_subshells)
+            {
+                subshells.push_back(std::move(entry.second));
+            }
+            m_subshells.clear();
+            std::move(m_deleted_subshells.begin(), m_deleted_subshells.end(), std::back_inserter(subshells));
+            m_deleted_subshells.clear();
+        }
+
+        // Subshells running a request are joined once it has completed
+        stop_subshell(m_responder);
+        for (auto& sub : subshells)
+        {
+            stop_subshell(*sub);
+        }
+    }
+
+    control_runner::control_runner(shell_runner& shell)
+        : m_shell(shell)
+        , p_server(nullptr)
+    {
+    }
+
+    void control_runner::set_server(xeus::xserver& server)
+    {
+        p_server = &server;
+    }
+
+    void control_runner::run_impl()
+    {
+        while (!is_stopped())
+        {
+            std::optional<xeus::xmessage> msg = read_control();
+            if (msg.has_value() && !handle_subshell_request(msg.value()))
+            {
+                notify_control_listener(std::move(msg.value()));
+            }
+        }
+        stop_channels();
+    }
+
+    bool control_runner::handle_subshell_request(const xeus::xmessage& msg)
+    {
+        std::string msg_type = msg.header().value("msg_type", "");
+        if (msg_type == "create_subshell_request")
+        {
+            send_reply(msg, "create_subshell_reply", {
+                {"status", "ok"},
+                {"subshell_id", m_shell.create_subshell()}
+            });
+        }
+        else if (msg_type == "delete_subshell_request")
+        {
+            std::string subshell_id = msg.content().value("subshell_id", "");
+            if (m_shell.delete_subshell(subshell_id))
+            {
+                send_reply(msg, "delete_subshell_reply", {{"status", "ok"}});
+            }
+            else
+            {
+                send_reply(msg, "delete_subshell_reply", {
+                    {"status", "error"},
+                    {"ename", "KeyError"},
+                    {"evalue", "Unknown subshell_id: " + subshell_id},
+                    {"traceback", nl::json::array()}
+                });
+            }
+        }
+        else if (msg_type == "list_subshell_request")
+        {
+            send_reply(msg, "list_subshell_reply", {
+                {"status", "ok"},
+                {"subshell_id", m_shell.list_subshells()}
+            });
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    void control_runner::send_reply(const xeus::xmessage& request, const std::string& reply_type, nl::json content)
+    {
+        const nl::json& header = request.header();
+        xeus::xmessage reply(request.identities(),
+                             xeus::make_header(reply_type, header.value("username", ""), header.value("session", "")),
+                             header,
+                             nl::json::object(),
+                             std::move(content),
+                             xeus::buffer_sequence());
+        p_server->send_control(std::move(reply));
+    }
+
+    std::unique_ptr<xeus::xserver> make_concurrent_server(xeus::xcontext& context,
+                                                          const xeus::xconfiguration& config,
+                                                          nl::json::error_handler_t eh)
+    {
+        auto runner = std::make_unique<shell_runner>(context);
+        shell_runner& shell = *runner;
+        // Inspection requests received during an execution are forwarded
+        // to the completion worker by the interpreter.
+        if (completion_worker_enabled())
+        {
+            runner->add_concurrent_message_type("inspect_request");
+        }
+
+#ifdef Py_GIL_DISABLED
+        // Subshells rely on the GIL to share the kernel core
+        auto server = xeus::make_xserver_shell(context,
+                                               config,
+                                               eh,
+                                               std::make_unique<xeus::xcontrol_default_runner>(),
+                                               std::move(runner));
+        shell.set_server(*server);
+        return std::make_unique<routed_server>(std::move(server), shell);
+#else
+        auto control = std::make_unique<control_runner>(shell);
+        control_runner& subshell_control = *control;
+        auto server = xeus::make_xserver_shell(context,
+                                               config,
+                                               eh,
+                                               std::move(control),
+                                               std::move(runner));
+        shell.set_server(*server);
+        auto routed = std::make_unique<routed_server>(std::move(server), shell);
+        subshell_control.set_server(*routed);
+        set_subshells_enabled(true);
+        return routed;
+#endif
+    }
+}
@@ -19,6 +19,7 @@
 
 #include "xstream.hpp"
 #include "xinternal_utils.hpp"
+#include "xtimer.hpp"
 
 namespace py = pybind11;
 
@@ -53,7 +54,8 @@ namespace xpyt
 
     xstream::xstream(std::string stream_name)
         : m_stream_name(stream_name), m_write_func(py::cpp_function([stream_name](const std::string& message) {
-            xeus::get_interpreter().publish_stream(stream_name, message);
+            xtimer::scope timing(get_execution_timer(), "publish");
+            get_kernel_interpreter().publish_stream(stream_name, message);
         }))
     {
     }
@@ -154,7 +156,7 @@ namespace xpyt
 
     py::module get_stream_module()
     {
-        static py::module stream_module = get_stream_module_impl();
-        return stream_module;
+        static xinterpreter_singleton stream_module("stream", get_stream_module_impl);
+        return py::reinterpret_borrow<py::module>(stream_module.get());
     }
 }
@@ -0,0 +1,273 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+
+#include "xinspect.hpp"
+#include "xinternal_utils.hpp"
+#include "xsymbol_index.hpp"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        // Characters after which an identifier starts a new expression.
+        // Magics prefixes (% and !) are deliberately excluded.
+        bool is_separator(char c)
+        {
+            return std::strchr(" \t\r\n([{,=:+-*/<>&|^~;@", c) != nullptr;
+        }
+
+        // Converts a cursor position expressed in unicode code points to a
+        // byte offset in the UTF-8 encoded code.
+        std::size_t to_byte_offset(const std::string& code, int cursor_pos)
+        {
+            std::size_t offset = 0;
+            int chars = 0;
+            while (offset < code.size() && chars < cursor_pos)
+            {
+                ++offset;
+                while (offset < code.size() && (static_cast<unsigned char>(code[offset]) & 0xC0) == 0x80)
+                {
+                    ++offset;
+                }
+                ++chars;
+            }
+            return offset;
+        }
+
+        std::size_t count_occurrences(const std::string& str, const char* pattern)
+        {
+            std::size_t count = 0;
+            for (std::size_t pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + 3))
+            {
+                ++count;
+            }
+            return count;
+        }
+
+        // Strings, comments and import statements are left to the inference engines
+        bool is_plain_code(const std::string& code)
+        {
+            if (count_occurrences(code, "\"\"\"") % 2 != 0 || count_occurrences(code, "'''") % 2 != 0)
+            {
+                return false;
+            }
+
+            std::size_t line_start = code.rfind('\n');
+            line_start = line_start == std::string::npos ? 0 : line_start + 1;
+            if (code.find_first_of("'\"#", line_start) != std::string::npos)
+            {
+                return false;
+            }
+
+            std::size_t first = code.find_first_not_of(" \t", line_start);
+            if (first == std::string::npos)
+            {
+                return true;
+            }
+            return code.compare(first, 7, "import ") != 0 && code.compare(first, 5, "from ") != 0;
+        }
+
+        // True when the innermost bracket left open in code is a parenthesis.
+        // The completions inside a call include the names of its keyword
+        // arguments, which only the inference engines know.
+        bool in_open_parenthesis(const std::string& code)
+        {
+            std::vector<char> brackets;
+            std::string quote;
+            std::size_t pos = 0;
+            while (pos < code.size())
+            {
+                char c = code[pos];
+                if (!quote.empty())
+                {
+                    if (c == '\\')
+                    {
+                        pos += 2;
+                        continue;
+                    }
+                    if (code.compare(pos, quote.size(), quote) == 0)
+                    {
+                        pos += quote.size();
+                        quote.clear();
+                        continue;
+                    }
+                }
+                else if (c == '\'' || c == '"')
+                {
+                    quote = code.compare(pos, 3, std::string(3, c)) == 0 ? std::string(3, c) : std::string(1, c);
+                    pos += quote.size();
+                    continue;
+                }
+                else if (c == '#')
+                {
+                    pos = code.find('\n', pos);
+                    continue;
+                }
+                else if (c == '(' || c == '[' || c == '{')
+                {
+                    brackets.push_back(c);
+                }
+                else if ((c == ')' || c == ']' || c == '}') && !brackets.empty())
+                {
+                    brackets.pop_back();
+                }
+                ++pos;
+            }
+            return !brackets.empty() && brackets.back() == '(';
+        }
+
+        void add_matches(const std::vector<std::string>& names, const std::string& prefix, std::vector<std::string>& matches)
+        {
+            bool include_private = prefix[0] == '_';
+            for (auto it = std::lower_bound(names.begin(), names.end(), prefix);
+                 it != names.end() && it->compare(0, prefix.size(), prefix) == 0;
+                 ++it)
+            {
+                if (include_private || (*it)[0] != '_')
+                {
+                    matches.push_back(*it);
+                }
+            }
+        }
+
+        void add_names(const py::handle& names, std::vector<std::string>& res)
+        {
+            for (py::handle name : names)
+            {
+                if (PyUnicode_Check(name.ptr()))
+                {
+                    res.push_back(name.cast<std::string>());
+                }
+            }
+        }
+
+        void sort_names(std::vector<std::string>& names)
+        {
+            std::sort(names.begin(), names.end());
+            names.erase(std::unique(names.begin(), names.end()), names.end());
+        }
+    }
+
+    /********************************
+     * xsymbol_index implementation *
+     ********************************/
+
+    bool xsymbol_index::complete(const std::string& code, int cursor_pos, const py::dict& ns, xcompletion_result& result)
+    {
+        std::string before = code.substr(0, to_byte_offset(code, cursor_pos));
+        if (!is_plain_code(before) || in_open_parenthesis(before))
+        {
+            return false;
+        }
+
+        std::size_t start = before.size();
+        while (start != 0 && is_identifier_char(before[start - 1]))
+        {
+            --start;
+        }
+
+        std::string prefix = before.substr(start);
+        if (prefix.empty() || std::isdigit(static_cast<unsigned char>(prefix[0])))
+        {
+            return false;
+        }
+
+        const std::vector<std::string>* names = nullptr;
+        if (start != 0 && before[start - 1] == '.')
+        {
+            std::size_t module_start = start - 1;
+            while (module_start != 0 && is_identifier_char(before[module_start - 1]))
+            {
+                --module_start;
+            }
+            std::string module_name = before.substr(module_start, start - 1 - module_start);
+            if (module_name.empty() || (module_start != 0 && !is_separator(before[module_start - 1])))
+            {
+                return false;
+            }
+
+            // Attributes of other objects require evaluating the expression
+            py::str key(module_name);
+            if (!ns.contains(key) || !PyModule_Check(py::object(ns[key]).ptr()))
+            {
+                return false;
+            }
+            names = &module_attributes(ns[key]);
+        }
+        else
+        {
+            if (start != 0 && !is_separator(before[start - 1]))
+            {
+                return false;
+            }
+            update(ns);
+            names = &m_names;
+        }
+
+        // Names missing from the index, such as the attributes added to a
+        // module by its __getattr__, are left to the inference engines
+        result.m_matches.clear();
+        add_matches(*names, prefix, result.m_matches);
+        if (result.m_matches.empty())
+        {
+            return false;
+        }
+        result.m_prefix_length = static_cast<std::size_t>(std::count_if(prefix.begin(), prefix.end(),
+            [](char c) { return (static_cast<unsigned char>(c) & 0xC0) != 0x80; }));
+        result.m_partial = false;
+        return true;
+    }
+
+    void xsymbol_index::update(const py::dict& ns)
+    {
+        std::size_t version = get_namespace_version();
+        if (m_initialized && version == m_version)
+        {
+            return;
+        }
+
+        m_names.clear();
+        add_names(ns, m_names);
+        add_names(py::module::import("builtins").attr("__dict__"), m_names);
+        add_names(py::module::import("keyword").attr("kwlist"), m_names);
+        sort_names(m_names);
+
+        m_version = version;
+        m_initialized = true;
+    }
+
+    const std::vector<std::string>& xsymbol_index::module_attributes(const py::handle& module)
+    {
+        std::string name = py::str(module.attr("__name__")).cast<std::string>();
+        auto id = reinterpret_cast<std::uintptr_t>(module.ptr());
+        std::size_t size = py::len(module.attr("__dict__"));
+
+        module_entry& entry = m_modules[name];
+        if (entry.m_id != id || entry.m_size != size)
+        {
+            entry.m_id = id;
+            entry.m_size = size;
+            entry.m_attributes.clear();
+            add_names(py::module::import("builtins").attr("dir")(module), entry.m_attributes);
+            sort_names(entry.m_attributes);
+        }
+        return entry.m_attributes;
+    }
+}
@@ -0,0 +1,76 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_SYMBOL_INDEX_HPP
+#define XPYT_SYMBOL_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    struct xcompletion_result
+    {
+        std::vector<std::string> m_matches;
+        // Number of characters before the cursor replaced by the matches
+        std::size_t m_prefix_length = 0;
+        // True when the deadline expired and the matches were computed
+        // from the names of the namespace only.
+        bool m_partial = false;
+    };
+
+    /*****************************
+     * xsymbol_index declaration *
+     *****************************/
+
+    // Sorted index of the names of the user namespace, the builtins, the
+    // keywords and the attributes of the modules bound in the namespace.
+    // It answers the completion of a bare identifier or of a module.attr
+    // prefix with a binary search, and leaves any other expression, the
+    // completions inside a call and the prefixes it has no match for to
+    // the inference engines.
+    //
+    // The namespace names are re-indexed when the namespace version changes,
+    // module attributes are re-indexed when the module dict changes size.
+    class xsymbol_index
+    {
+    public:
+
+        // Returns false when the code is not a simple prefix completion.
+        // Must be called with the GIL held.
+        bool complete(const std::string& code, int cursor_pos, const py::dict& ns, xcompletion_result& result);
+
+    private:
+
+        struct module_entry
+        {
+            std::uintptr_t m_id = 0;
+            std::size_t m_size = 0;
+            std::vector<std::string> m_attributes;
+        };
+
+        void update(const py::dict& ns);
+        const std::vector<std::string>& module_attributes(const py::handle& module);
+
+        bool m_initialized = false;
+        std::size_t m_version = 0;
+        std::vector<std::string> m_names;
+        std::unordered_map<std::string, module_entry> m_modules;
+    };
+}
+
+#endif
@@ -0,0 +1,258 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+#include "xtimeit.hpp"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        // Minimal duration of a run when the number of loops is calibrated
+        constexpr double calibration_duration = 0.2;
+
+        std::string indent(const std::string& code, const std::string& prefix)
+        {
+            std::string res = prefix;
+            for (char c : code)
+            {
+                res += c;
+                if (c == '\n')
+                {
+                    res += prefix;
+                }
+            }
+            return res;
+        }
+
+        // Same layout as the inner function of the timeit module, timed
+        // with a clock provided by the caller
+        std::string make_inner_source(const std::string& stmt, const std::string& setup)
+        {
+            return "def inner(_xpyt_it, _xpyt_clock):\n"
+                + indent(setup, "    ") + "\n"
+                + "    _xpyt_t0 = _xpyt_clock()\n"
+                + "    for _xpyt_i in _xpyt_it:\n"
+                + indent(stmt, "        ") + "\n"
+                + "    return _xpyt_clock() - _xpyt_t0\n";
+        }
+
+        double percentile(const std::vector<double>& sorted_values, double p)
+        {
+            double rank = p / 100. * double(sorted_values.size() - 1);
+            std::size_t lower = static_cast<std::size_t>(std::floor(rank));
+            std::size_t upper = std::min(lower + 1, sorted_values.size() - 1);
+            double weight = rank - double(lower);
+            return sorted_values[lower] * (1. - weight) + sorted_values[upper] * weight;
+        }
+
+        // Same format as IPython. Non ASCII characters are escaped UTF-8,
+        // MSVC reads sources in the local code page by default.
+        std::string format_time(double seconds)
+        {
+            static const char* units[] = {"s", "ms", "\xC2\xB5s", "ns"};
+            int order = 0;
+            if (seconds > 0.)
+            {
+                order = std::min(std::max(-int(std::floor(std::log10(seconds) / 3.)), 0), 3);
+            }
+
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.3g %s", seconds * std::pow(1000., order), units[order]);
+            return buffer;
+        }
+
+        std::string format_count(std::size_t count)
+        {
+            std::string digits = std::to_string(count);
+            std::string res;
+            for (std::size_t i = 0; i < digits.size(); ++i)
+            {
+                if (i != 0 && (digits.size() - i) % 3 == 0)
+                {
+                    res += ',';
+                }
+                res += digits[i];
+            }
+            return res;
+        }
+
+        // Disables the garbage collector for the lifetime of the guard
+        class xgc_guard
+        {
+        public:
+
+            xgc_guard()
+                : m_gc(py::module::import("gc"))
+                , m_enabled(m_gc.attr("isenabled")().cast<bool>())
+            {
+                m_gc.attr("disable")();
+            }
+
+            ~xgc_guard()
+            {
+                if (m_enabled)
+                {
+                    m_gc.attr("enable")();
+                }
+            }
+
+            xgc_guard(const xgc_guard&) = delete;
+            xgc_guard& operator=(const xgc_guard&) = delete;
+
+        private:
+
+            py::module m_gc;
+            bool m_enabled;
+        };
+    }
+
+    nl::json timeit(const std::string& stmt,
+                    const std::string& setup,
+                    std::size_t number,
+                    std::size_t repeat,
+                    const py::dict& globals)
+    {
+        if (repeat == 0)
+        {
+            throw std::invalid_argument("repeat must be greater than 0");
+        }
+
+        // Syntax errors are reported against the statement rather than
+        // against the generated function
+        py::module builtins = py::module::import("builtins");
+        builtins.attr("compile")(stmt, "<timeit>", "exec");
+        builtins.attr("compile")(setup, "<timeit>", "exec");
+
+        py::dict local_ns;
+        builtins.attr("exec")(builtins.attr("compile")(make_inner_source(stmt, setup), "<timeit>", "exec"), globals, local_ns);
+        py::object inner = local_ns["inner"];
+
+        py::cpp_function clock([]()
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        });
+        py::object repeat_iterator = py::module::import("itertools").attr("repeat");
+
+        auto run = [&](std::size_t loops)
+        {
+            return inner(repeat_iterator(py::none(), loops), clock).cast<double>();
+        };
+
+        xgc_guard gc_guard;
+
+        // Same sequence as timeit.Timer.autorange: 1, 2, 5, 10, 20, 50...
+        if (number == 0)
+        {
+            for (std::size_t base = 1; number == 0; base *= 10)
+            {
+                for (std::size_t factor : {1, 2, 5})
+                {
+                    if (run(base * factor) >= calibration_duration)
+                    {
+                        number = base * factor;
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<double> timings;
+        timings.reserve(repeat);
+        for (std::size_t i = 0; i < repeat; ++i)
+        {
+            timings.push_back(run(number) / double(number));
+        }
+
+        double mean = 0.;
+        for (double timing : timings)
+        {
+            mean += timing;
+        }
+        mean /= double(repeat);
+
+        double variance = 0.;
+        for (double timing : timings)
+        {
+            variance += (timing - mean) * (timing - mean);
+        }
+        variance /= double(repeat);
+
+        std::vector<double> sorted_timings = timings;
+        std::sort(sorted_timings.begin(), sorted_timings.end());
+
+        return {
+            {"loops", number},
+            {"repeat", repeat},
+            {"mean", mean},
+            {"stdev", std::sqrt(variance)},
+            {"min", sorted_timings.front()},
+            {"max", sorted_timings.back()},
+            {"percentiles", {
+                {"5", percentile(sorted_timings, 5.)},
+                {"25", percentile(sorted_timings, 25.)},
+                {"50", percentile(sorted_timings, 50.)},
+                {"75", percentile(sorted_timings, 75.)},
+                {"95", percentile(sorted_timings, 95.)}
+            }},
+            {"timings", timings}
+        };
+    }
+
+    nl::json make_timeit_mime_bundle(const nl::json& result)
+    {
+        std::size_t loops = result["loops"].get<std::size_t>();
+        std::size_t repeat = result["repeat"].get<std::size_t>();
+        const nl::json& percentiles = result["percentiles"];
+
+        std::string text = format_time(result["mean"].get<double>()) + " \xC2\xB1 "
+            + format_time(result["stdev"].get<double>()) + " per loop (mean \xC2\xB1 std. dev. of "
+            + format_count(repeat) + (repeat == 1 ? " run, " : " runs, ")
+            + format_count(loops) + (loops == 1 ? " loop each)" : " loops each)");
+        std::string details = "min " + format_time(result["min"].get<double>())
+            + ", p5 " + format_time(percentiles["5"].get<double>())
+            + ", median " + format_time(percentiles["50"].get<double>())
+            + ", p95 " + format_time(percentiles["95"].get<double>())
+            + ", max " + format_time(result["max"].get<double>());
+
+        std::string html = "<table>\n<caption>" + text + "</caption>\n"
+            "<thead><tr><th>min</th><th>p5</th><th>p25</th><th>median</th><th>p75</th><th>p95</th><th>max</th></tr></thead>\n"
+            "<tbody><tr>"
+            "<td>" + format_time(result["min"].get<double>()) + "</td>"
+            "<td>" + format_time(percentiles["5"].get<double>()) + "</td>"
+            "<td>" + format_time(percentiles["25"].get<double>()) + "</td>"
+            "<td>" + format_time(percentiles["50"].get<double>()) + "</td>"
+            "<td>" + format_time(percentiles["75"].get<double>()) + "</td>"
+            "<td>" + format_time(percentiles["95"].get<double>()) + "</td>"
+            "<td>" + format_time(result["max"].get<double>()) + "</td>"
+            "</tr></tbody>\n</table>";
+
+        return {
+            {"text/plain", text + "\n" + details},
+            {"text/html", html},
+            {"application/vnd.xpython.timeit+json", result}
+        };
+    }
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_TIMEIT_HPP
+#define XPYT_TIMEIT_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "nlohmann/json.hpp"
+
+#include "pybind11/pybind11.h"
+
+namespace nl = nlohmann;
+namespace py = pybind11;
+
+namespace xpyt
+{
+    // Times stmt, the counterpart of %timeit available in both kernels.
+    //
+    // As in the timeit module, stmt runs in a loop compiled into a
+    // function, after setup, with the given namespace as globals. The loop
+    // is timed with a steady clock. When number is 0, the number of loops
+    // is calibrated so that a run lasts at least 0.2 seconds. The garbage
+    // collector is disabled while timing.
+    //
+    // Returns the statistics of the time per loop over the repeated runs,
+    // in seconds. Must be called with the GIL held.
+    nl::json timeit(const std::string& stmt,
+                    const std::string& setup,
+                    std::size_t number,
+                    std::size_t repeat,
+                    const py::dict& globals);
+
+    // Text, HTML and JSON representations of the statistics returned by
+    // timeit
+    nl::json make_timeit_mime_bundle(const nl::json& result);
+}
+
+#endif
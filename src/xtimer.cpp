@@ -0,0 +1,184 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xtimer.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /********************************
+     * xtimer::scope implementation *
+     ********************************/
+
+    xtimer::scope::scope(xtimer& timer, std::string phase)
+        : m_timer(timer)
+        , m_phase(std::move(phase))
+        , m_start(clock_type::now())
+    {
+    }
+
+    xtimer::scope::~scope()
+    {
+        m_timer.add(m_phase, elapsed());
+    }
+
+    auto xtimer::scope::elapsed() const -> duration_type
+    {
+        return clock_type::now() - m_start;
+    }
+
+    /*************************
+     * xtimer implementation *
+     *************************/
+
+    void xtimer::start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_phases.clear();
+        m_running = true;
+    }
+
+    void xtimer::stop()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+        m_last_phases = m_phases;
+    }
+
+    bool xtimer::running() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_running;
+    }
+
+    void xtimer::add(const std::string& phase, duration_type duration)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+        {
+            return;
+        }
+
+        auto it = std::find_if(m_phases.begin(), m_phases.end(),
+                               [&phase](const auto& p) { return p.first == phase; });
+        if (it == m_phases.end())
+        {
+            m_phases.emplace_back(phase, duration);
+        }
+        else
+        {
+            it->second += duration;
+        }
+    }
+
+    void xtimer::add_exclusive(const std::string& phase,
+                               duration_type duration,
+                               const std::vector<std::string>& nested)
+    {
+        for (const auto& nested_phase : nested)
+        {
+            duration -= get(nested_phase);
+        }
+        add(phase, std::max(duration, duration_type::zero()));
+    }
+
+    auto xtimer::get(const std::string& phase) const -> duration_type
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(m_phases.begin(), m_phases.end(),
+                               [&phase](const auto& p) { return p.first == phase; });
+        return it == m_phases.end() ? duration_type::zero() : it->second;
+    }
+
+    nl::json xtimer::to_json() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return to_json(m_phases);
+    }
+
+    nl::json xtimer::last_to_json() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return to_json(m_last_phases);
+    }
+
+    nl::json xtimer::to_json(const phase_list& phases)
+    {
+        nl::json res = nl::json::object();
+        for (const auto& phase : phases)
+        {
+            res[phase.first] = std::chrono::duration<double>(phase.second).count();
+        }
+        return res;
+    }
+
+    xtimer& get_execution_timer()
+    {
+        thread_local xtimer timer;
+        return timer;
+    }
+
+    namespace
+    {
+        // The library load time, or the fork time in forked kernels
+        xtimer::clock_type::time_point startup_time = xtimer::clock_type::now();
+    }
+
+    xtimer& get_startup_timer()
+    {
+        static xtimer timer;
+        static bool started = (timer.start(), true);
+        (void)started;
+        return timer;
+    }
+
+    void write_startup_timings()
+    {
+        static std::once_flag written;
+        std::call_once(written, []()
+        {
+            const char* path = std::getenv("XPYTHON_STARTUP_TIMINGS");
+            if (path == nullptr)
+            {
+                return;
+            }
+
+            xtimer& timer = get_startup_timer();
+            timer.add("first_kernel_info", xtimer::clock_type::now() - startup_time);
+            timer.stop();
+
+            std::ofstream out(path);
+            out << timer.to_json().dump(4) << std::endl;
+        });
+    }
+
+    void add_startup_timing(const std::string& stage, xtimer::duration_type duration)
+    {
+        get_startup_timer().add(stage, duration);
+    }
+
+    void reset_startup_timer()
+    {
+        startup_time = xtimer::clock_type::now();
+        get_startup_timer().start();
+    }
+}
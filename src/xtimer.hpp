@@ -0,0 +1,116 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_TIMER_HPP
+#define XPYT_TIMER_HPP
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+#include "xeus-python/xeus_python_config.hpp"
+
+namespace nl = nlohmann;
+
+namespace xpyt
+{
+    /**********************
+     * xtimer declaration *
+     **********************/
+
+    // Accumulates the time spent in named phases, measured with a
+    // monotonic clock. Durations are only recorded between start and
+    // stop, and are reported in seconds.
+    class xtimer
+    {
+    public:
+
+        using clock_type = std::chrono::steady_clock;
+        using duration_type = clock_type::duration;
+
+        class scope
+        {
+        public:
+
+            scope(xtimer& timer, std::string phase);
+            ~scope();
+
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+
+            duration_type elapsed() const;
+
+        private:
+
+            xtimer& m_timer;
+            std::string m_phase;
+            clock_type::time_point m_start;
+        };
+
+        void start();
+        void stop();
+        bool running() const;
+
+        void add(const std::string& phase, duration_type duration);
+        // Records duration minus the time spent in the nested phases
+        void add_exclusive(const std::string& phase,
+                           duration_type duration,
+                           const std::vector<std::string>& nested);
+        duration_type get(const std::string& phase) const;
+
+        nl::json to_json() const;
+        // Phases recorded between the last completed start and stop
+        nl::json last_to_json() const;
+
+    private:
+
+        using phase_list = std::vector<std::pair<std::string, duration_type>>;
+
+        static nl::json to_json(const phase_list& phases);
+
+        mutable std::mutex m_mutex;
+        phase_list m_phases;
+        phase_list m_last_phases;
+        bool m_running = false;
+    };
+
+    // Timer of the execute requests. The running request reports its
+    // phases in its reply, user code reads those of the previous one.
+    // There is one timer per thread, so that the requests running on
+    // subshell threads do not interleave their phases with the ones of
+    // the main shell.
+    xtimer& get_execution_timer();
+
+    // Timer of the startup stages, started when the library is loaded
+    xtimer& get_startup_timer();
+
+    // Writes the startup stages, and the time elapsed until this call, to
+    // the file named by the XPYTHON_STARTUP_TIMINGS environment variable.
+    // Called when the first kernel_info request is answered, only the
+    // first call writes the file.
+    void write_startup_timings();
+
+    // Records the duration of a startup stage, see XPYTHON_STARTUP_TIMINGS.
+    // Exported for xpython, this is not part of the public API.
+    XEUS_PYTHON_API
+    void add_startup_timing(const std::string& stage, xtimer::duration_type duration);
+
+    // Restarts the startup timer and the time first_kernel_info is measured
+    // from. The startup of a kernel forked by the fork server begins at the
+    // fork, not when the library was loaded in the fork server.
+    XEUS_PYTHON_API
+    void reset_startup_timer();
+}
+
+#endif
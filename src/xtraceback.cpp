@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 
@@ -29,17 +30,41 @@ namespace xpyt
         return get_cell_tmp_file(raw_code);
     }
 
-    using filename_map = std::map<std::string, int>;
-
-    filename_map& get_filename_map()
+    namespace
     {
-        static filename_map fnm;
-        return fnm;
+        using filename_map = std::map<std::string, int>;
+
+        // Cells are registered when compiled and looked up when formatting
+        // tracebacks, possibly from different threads when the GIL is disabled.
+        std::mutex filename_map_mutex;
+
+        // Cells with the same content share their file, the mapping is kept
+        // per interpreter so that kernels of the same process do not share
+        // their execution counts. Must be called with the GIL held.
+        filename_map& get_filename_map()
+        {
+            return get_interpreter_local<filename_map>("filename_map");
+        }
+
+        bool find_execution_count(const std::string& filename, int& execution_count)
+        {
+            filename_map& fnm = get_filename_map();
+            std::lock_guard<std::mutex> lock(filename_map_mutex);
+            auto it = fnm.find(filename);
+            if (it == fnm.end())
+            {
+                return false;
+            }
+            execution_count = it->second;
+            return true;
+        }
     }
 
     void register_filename_mapping(const std::string& filename, int execution_count)
     {
-        get_filename_map()[filename] = execution_count;
+        filename_map& fnm = get_filename_map();
+        std::lock_guard<std::mutex> lock(filename_map_mutex);
+        fnm[filename] = execution_count;
     }
 
     xerror extract_error(const py::list& error)
@@ -123,10 +148,10 @@ namespace xpyt
                     if(!filename.empty() && !filename.compare(0, prefix.size(), prefix.c_str(), prefix.size()))
                     {
                         file_prefix = "In  ";
-                        auto it = get_filename_map().find(filename);
-                        if(it != get_filename_map().end())
+                        int execution_count = 0;
+                        if (find_execution_count(filename, execution_count))
                         {
-                            filename = '[' + std::to_string(it->second) + ']';
+                            filename = '[' + std::to_string(execution_count) + ']';
                         }
                     }
                     else
@@ -175,7 +200,7 @@ namespace xpyt
 
     py::module get_traceback_module()
     {
-        static py::module traceback_module = get_traceback_module_impl();
-        return traceback_module;
+        static xinterpreter_singleton traceback_module("traceback", get_traceback_module_impl);
+        return py::reinterpret_borrow<py::module>(traceback_module.get());
     }
 }
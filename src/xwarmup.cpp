@@ -0,0 +1,150 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "xeus-python/xutils.hpp"
+
+#include "xinternal_utils.hpp"
+#include "xtimer.hpp"
+#include "xwarmup.hpp"
+
+namespace py = pybind11;
+
+namespace xpyt
+{
+    namespace
+    {
+        py::module make_warmup_module()
+        {
+            py::module warmup_module = create_module("warmup");
+
+            exec(py::str(R"(
+import importlib
+import threading
+
+def _warmup(modules):
+    for name in modules:
+        try:
+            importlib.import_module(name)
+        except Exception:
+            # Warm-up modules are optional
+            pass
+
+_thread = None
+
+def start(modules):
+    global _thread
+    # Subinterpreters with their own GIL do not allow daemon threads, the
+    # thread is joined when the kernel shuts down.
+    _thread = threading.Thread(target=_warmup, args=(modules,), name='xpython-warmup')
+    _thread.start()
+
+def join():
+    if _thread is not None:
+        _thread.join()
+            )"), warmup_module.attr("__dict__"));
+
+            return warmup_module;
+        }
+
+        // Per interpreter, the module holds the warm-up thread
+        py::module get_warmup_module()
+        {
+            static xinterpreter_singleton warmup_module("warmup", make_warmup_module);
+            return py::reinterpret_borrow<py::module>(warmup_module.get());
+        }
+    }
+
+    std::vector<std::string> get_warmup_modules()
+    {
+        const char* env = std::getenv("XPYTHON_WARMUP_MODULES");
+        if (env == nullptr)
+        {
+            return {"jedi", "pygments.lexers.python"};
+        }
+
+        std::vector<std::string> res;
+        std::stringstream modules(env);
+        std::string name;
+        while (std::getline(modules, name, ','))
+        {
+            std::size_t first = name.find_first_not_of(" \t");
+            if (first != std::string::npos)
+            {
+                res.push_back(name.substr(first, name.find_last_not_of(" \t") - first + 1));
+            }
+        }
+        return res;
+    }
+
+    void start_warmup()
+    {
+#ifndef XPYT_EMSCRIPTEN_WASM_BUILD
+        py::gil_scoped_acquire acquire;
+        // Once per interpreter, each kernel of the kernel host warms up its
+        // own subinterpreter
+        bool& started = get_interpreter_local<bool>("warmup_started");
+        if (started)
+        {
+            return;
+        }
+        started = true;
+
+        std::vector<std::string> modules = get_warmup_modules();
+        if (modules.empty())
+        {
+            return;
+        }
+
+        try
+        {
+            get_warmup_module().attr("start")(modules);
+        }
+        catch (py::error_already_set& e)
+        {
+            std::clog << "Could not start the warm-up thread: " << e.what() << std::endl;
+        }
+#endif
+    }
+
+    void join_warmup()
+    {
+#ifndef XPYT_EMSCRIPTEN_WASM_BUILD
+        py::gil_scoped_acquire acquire;
+        if (!get_interpreter_local<bool>("warmup_started"))
+        {
+            return;
+        }
+
+        try
+        {
+            get_warmup_module().attr("join")();
+        }
+        catch (py::error_already_set& e)
+        {
+            std::clog << "Could not join the warm-up thread: " << e.what() << std::endl;
+        }
+#endif
+    }
+
+    void on_kernel_info_request()
+    {
+        write_startup_timings();
+        start_warmup();
+    }
+}
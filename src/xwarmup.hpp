@@ -0,0 +1,41 @@
+/***************************************************************************
+* Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and     *
+* Wolf Vollprecht                                                          *
+* Copyright (c) 2018, QuantStack                                           *
+*                                                                          *
+* Distributed under the terms of the BSD 3-Clause License.                 *
+*                                                                          *
+* The full license is in the file LICENSE, distributed with this software. *
+****************************************************************************/
+
+#ifndef XPYT_WARMUP_HPP
+#define XPYT_WARMUP_HPP
+
+#include <string>
+#include <vector>
+
+namespace xpyt
+{
+    // Modules imported by the warm-up thread, read from the comma-separated
+    // XPYTHON_WARMUP_MODULES environment variable. An empty value disables
+    // the warm-up. Defaults to the modules used by completion and inspection.
+    std::vector<std::string> get_warmup_modules();
+
+    // Imports the warm-up modules on a Python thread, the first time it is
+    // called in an interpreter. Imports use per-module locks: a cell
+    // importing one of these modules only waits for that module to be
+    // imported. Acquires the GIL.
+    void start_warmup();
+
+    // Waits for the warm-up thread of the current interpreter, which is not
+    // a daemon thread since subinterpreters with their own GIL do not allow
+    // them. Called when the kernel shuts down. Acquires the GIL.
+    void join_warmup();
+
+    // Called on every kernel_info request. Frontends send one once
+    // connected: the startup timings are written and the warm-up modules are
+    // imported while the user types the first cell. Acquires the GIL.
+    void on_kernel_info_request();
+}
+
+#endif
@@ -0,0 +1,130 @@
+#############################################################################
+# Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and      #
+# Wolf Vollprecht                                                           #
+# Copyright (c) 2018, QuantStack                                            #
+#                                                                           #
+# Distributed under the terms of the BSD 3-Clause License.                  #
+#                                                                           #
+# The full license is in the file LICENSE, distributed with this software.  #
+#############################################################################
+
+"""Startup benchmark of xpython.
+
+Launches xpython repeatedly, in normal and raw modes, and measures the wall
+time until the first kernel_info reply and the first execute reply. The
+per-stage timings reported by the kernel through XPYTHON_STARTUP_TIMINGS are
+collected as well. Results are written as JSON.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from jupyter_client import BlockingKernelClient
+from jupyter_client.connect import write_connection_file
+
+
+def wait_for_reply(client, msg_id, timeout):
+    while True:
+        reply = client.get_shell_msg(timeout=timeout)
+        if reply['parent_header'].get('msg_id') == msg_id:
+            return reply
+
+
+def run_once(xpython, raw, timeout):
+    tmpdir = tempfile.mkdtemp(prefix='xpython-benchmark-')
+    try:
+        connection_file = os.path.join(tmpdir, 'kernel.json')
+        timings_file = os.path.join(tmpdir, 'timings.json')
+        write_connection_file(connection_file, ip='127.0.0.1', key=os.urandom(16).hex().encode())
+
+        args = [xpython, '-f', connection_file] + (['--raw'] if raw else [])
+        env = dict(os.environ, XPYTHON_STARTUP_TIMINGS=timings_file)
+
+        start = time.perf_counter()
+        process = subprocess.Popen(args, env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        client = BlockingKernelClient(connection_file=connection_file)
+        client.load_connection_file()
+        client.start_channels()
+        try:
+            # Messages are queued by ZMQ until the kernel has bound its sockets
+            wait_for_reply(client, client.kernel_info(), timeout)
+            kernel_info = time.perf_counter() - start
+
+            wait_for_reply(client, client.execute('pass'), timeout)
+            execute = time.perf_counter() - start
+
+            client.shutdown()
+            process.wait(timeout=timeout)
+        finally:
+            client.stop_channels()
+            if process.poll() is None:
+                process.kill()
+                process.wait()
+
+        stages = {}
+        if os.path.exists(timings_file):
+            with open(timings_file) as f:
+                stages = json.load(f)
+
+        return {'kernel_info': kernel_info, 'execute': execute, 'stages': stages}
+    finally:
+        shutil.rmtree(tmpdir, ignore_errors=True)
+
+
+def summarize(values):
+    return {
+        'min': min(values),
+        'median': statistics.median(values),
+        'max': max(values),
+    }
+
+
+def benchmark(xpython, raw, repeat, timeout):
+    runs = [run_once(xpython, raw, timeout) for _ in range(repeat)]
+
+    summary = {
+        'kernel_info': summarize([run['kernel_info'] for run in runs]),
+        'execute': summarize([run['execute'] for run in runs]),
+    }
+    stage_names = sorted({name for run in runs for name in run['stages']})
+    summary['stages'] = {
+        name: summarize([run['stages'][name] for run in runs if name in run['stages']])
+        for name in stage_names
+    }
+    return {'runs': runs, 'summary': summary}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--xpython', default=shutil.which('xpython'), help='path of the xpython executable')
+    parser.add_argument('--repeat', type=int, default=5, help='number of launches per mode')
+    parser.add_argument('--timeout', type=float, default=60, help='timeout of each request, in seconds')
+    parser.add_argument('--output', help='JSON output file, defaults to the standard output')
+    args = parser.parse_args()
+
+    if args.xpython is None:
+        parser.error('xpython was not found, use --xpython')
+
+    results = {
+        'xpython': args.xpython,
+        'normal': benchmark(args.xpython, False, args.repeat, args.timeout),
+        'raw': benchmark(args.xpython, True, args.repeat, args.timeout),
+    }
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(results, f, indent=4)
+    else:
+        json.dump(results, sys.stdout, indent=4)
+        print()
+
+
+if __name__ == '__main__':
+    main()
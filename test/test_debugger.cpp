@@ -353,6 +353,21 @@ nl::json make_copy_to_globals_request(int seq, const std::string& src_var_name,
     return req;
 }
 
+nl::json make_sample_profile_request(int seq, double duration, double rate, bool native = false)
+{
+    nl::json req = {
+        {"type", "request"},
+        {"seq", seq},
+        {"command", "sampleProfile"},
+        {"arguments", {
+            {"duration", duration},
+            {"rate", rate},
+            {"native", native}
+        }}
+    };
+    return req;
+}
+
 nl::json make_exception_breakpoint_request(int seq)
 {
     nl::json except_option = {
@@ -402,6 +417,8 @@ public:
     bool test_rich_inspect_variables();
     bool test_variables();
     bool test_copy_to_globals();
+    bool test_sample_profile();
+    bool test_native_sample_profile_idle();
     void start();
     void shutdown();
     void disconnect_debugger();
@@ -759,6 +776,39 @@ bool debugger_client::test_inspect_variables()
     return res;
 }
 
+bool debugger_client::test_sample_profile()
+{
+    std::string code = "import time\ndef sampled_loop():\n    end = time.time() + 2\n    while time.time() < end:\n        pass\nsampled_loop()";
+    m_client.send_on_shell("execute_request", make_execute_request(code));
+    std::this_thread::sleep_for(200ms);
+
+    m_client.send_on_control("debug_request", make_sample_profile_request(0, 0.5, 100.));
+    nl::json rep = m_client.receive_on_control();
+    m_client.receive_on_shell();
+
+    nl::json body = rep["content"]["body"];
+    std::string stacks = body["collapsed_stacks"].get<std::string>();
+    return rep["content"]["success"].get<bool>()
+        && body["samples"].get<int>() > 0
+        && stacks.find("(sampled_loop)") != std::string::npos;
+}
+
+bool debugger_client::test_native_sample_profile_idle()
+{
+    // The main thread waits for the next request on the shell socket, the
+    // samples must not interrupt the poll
+    m_client.send_on_control("debug_request", make_sample_profile_request(0, 0.5, 100., true));
+    nl::json rep = m_client.receive_on_control();
+
+    m_client.send_on_shell("execute_request", make_execute_request("1 + 1"));
+    nl::json shell_rep = m_client.receive_on_shell();
+
+    nl::json body = rep["content"]["body"];
+    return rep["content"]["success"].get<bool>()
+        && body["samples"].get<int>() > 0
+        && shell_rep["content"]["status"] == "ok";
+}
+
 std::string rich_inspect_class_def = R"RICH(
 class Person:
     def __init__(self, name="John Doe", address="Paris", picture=""):
@@ -1456,4 +1506,36 @@ TEST_SUITE("debugger")
             t.notify_done();
         }
     }
-}
\ No newline at end of file
+
+    TEST_CASE("sample_profile")
+    {
+        start_kernel();
+        timer t;
+        auto context_ptr = xeus::make_zmq_context();
+        {
+            debugger_client deb(*context_ptr, KERNEL_JSON, "debugger_sample_profile.log");
+            deb.start();
+            bool res = deb.test_sample_profile();
+            deb.shutdown();
+            std::this_thread::sleep_for(2s);
+            CHECK(res);
+            t.notify_done();
+        }
+    }
+
+    TEST_CASE("native_sample_profile_idle")
+    {
+        start_kernel();
+        timer t;
+        auto context_ptr = xeus::make_zmq_context();
+        {
+            debugger_client deb(*context_ptr, KERNEL_JSON, "debugger_native_sample_profile_idle.log");
+            deb.start();
+            bool res = deb.test_native_sample_profile_idle();
+            deb.shutdown();
+            std::this_thread::sleep_for(2s);
+            CHECK(res);
+            t.notify_done();
+        }
+    }
+}
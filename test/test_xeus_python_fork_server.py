@@ -0,0 +1,104 @@
+#############################################################################
+# Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and      #
+# Wolf Vollprecht                                                           #
+# Copyright (c) 2018, QuantStack                                            #
+#                                                                           #
+# Distributed under the terms of the BSD 3-Clause License.                  #
+#                                                                           #
+# The full license is in the file LICENSE, distributed with this software.  #
+#############################################################################
+
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+from jupyter_client import BlockingKernelClient
+from jupyter_client.connect import write_connection_file
+
+TIMEOUT = 30
+
+
+@unittest.skipIf(sys.platform.startswith("win"), "The fork server relies on FIFOs")
+@unittest.skipIf(shutil.which("xpython") is None, "xpython is not installed")
+class XeusPythonForkServerTests(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.fifo = os.path.join(self.tmpdir, "fork_server")
+        self.server = None
+        self.client = None
+        self.kernel_pid = None
+
+    def tearDown(self):
+        if self.client is not None:
+            self.client.stop_channels()
+        if self.kernel_pid is not None:
+            try:
+                os.kill(self.kernel_pid, signal.SIGKILL)
+            except ProcessLookupError:
+                pass
+        if self.server is not None and self.server.poll() is None:
+            self.server.kill()
+            self.server.wait()
+        shutil.rmtree(self.tmpdir, ignore_errors=True)
+
+    def start_server(self):
+        self.server = subprocess.Popen(
+            ["xpython", "--fork-server", self.fifo],
+            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL
+        )
+
+    def wait_for(self, path):
+        deadline = time.monotonic() + TIMEOUT
+        while not os.path.exists(path):
+            self.assertIsNone(self.server.poll(), "The fork server exited")
+            self.assertLess(time.monotonic(), deadline, "Timed out waiting for " + path)
+            time.sleep(0.1)
+
+    def test_xeus_python_fork_server_kernel_pid(self):
+        self.start_server()
+        self.wait_for(self.fifo)
+
+        connection_file, _ = write_connection_file(os.path.join(self.tmpdir, "kernel.json"))
+        with open(self.fifo, "w") as fifo:
+            fifo.write(connection_file + "\n")
+
+        self.wait_for(connection_file + ".pid")
+        with open(connection_file + ".pid") as pid_file:
+            self.kernel_pid = int(pid_file.read())
+        self.assertNotEqual(self.kernel_pid, self.server.pid)
+
+        self.client = BlockingKernelClient(connection_file=connection_file)
+        self.client.load_connection_file()
+        self.client.start_channels()
+        self.client.wait_for_ready(timeout=TIMEOUT)
+
+        outputs = []
+        reply = self.client.execute_interactive(
+            "import os; print(os.getpid())", timeout=TIMEOUT,
+            output_hook=lambda msg: outputs.append(msg)
+        )
+        self.assertEqual(reply["content"]["status"], "ok")
+        streams = [msg["content"]["text"] for msg in outputs if msg["msg_type"] == "stream"]
+        self.assertEqual("".join(streams), "%d\n" % self.kernel_pid)
+
+    def test_xeus_python_fork_server_rejects_regular_file(self):
+        with open(self.fifo, "w"):
+            pass
+        self.start_server()
+        self.assertNotEqual(self.server.wait(timeout=TIMEOUT), 0)
+
+    def test_xeus_python_fork_server_rejects_shared_fifo(self):
+        os.mkfifo(self.fifo)
+        os.chmod(self.fifo, 0o622)
+        self.start_server()
+        self.assertNotEqual(self.server.wait(timeout=TIMEOUT), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
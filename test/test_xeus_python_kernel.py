@@ -8,11 +8,18 @@
 # The full license is in the file LICENSE, distributed with this software.  #
 #############################################################################
 
+import os
+import sys
+import sysconfig
+import time
 import unittest
 import jupyter_kernel_test
 
 from jupyter_client.manager import start_new_kernel
 
+TIMEOUT = 30
+
+
 class XeusPythonTests(jupyter_kernel_test.KernelTests):
 
     kernel_name = "xpython"
@@ -49,6 +56,580 @@ class XeusPythonTests(jupyter_kernel_test.KernelTests):
         reply, output_msgs = self.execute_helper(code='a = []; a.push_back(3)')
         self.assertEqual(output_msgs[0]['msg_type'], 'error')
 
+    def test_xeus_python_cached_parent_header(self):
+        reply, output_msgs = self.execute_helper(code="""
+kernel = get_ipython().kernel
+print(kernel.get_parent() is kernel._parent_header, kernel.get_parent()['header']['msg_type'])
+""")
+        self.assertEqual(output_msgs[0]['content']['text'], 'True execute_request')
+
+    def test_xeus_python_warmup_after_kernel_info(self):
+        self.flush_channels()
+        self.kc.kernel_info()
+        code = "import sys; print('jedi' in sys.modules)"
+        deadline = time.monotonic() + TIMEOUT
+        reply, output_msgs = self.execute_helper(code=code)
+        while output_msgs[0]['content']['text'] != 'True' and time.monotonic() < deadline:
+            time.sleep(0.1)
+            reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(output_msgs[0]['content']['text'], 'True')
+
+    @unittest.skipUnless(sys.platform.startswith('linux'), 'Native sampling requires glibc')
+    def test_xeus_python_input_while_native_sampling(self):
+        self.flush_channels()
+        msg_id = self.kc.execute("print(input('prompt: '))", allow_stdin=True)
+        request = self.kc.get_stdin_msg(timeout=TIMEOUT)
+        self.assertEqual(request['msg_type'], 'input_request')
+
+        # The main thread waits for the input reply while it is sampled,
+        # the signals must not interrupt the read of the stdin socket.
+        debug_request = self.kc.session.msg('debug_request', {
+            'type': 'request',
+            'seq': 1,
+            'command': 'sampleProfile',
+            'arguments': {'duration': 0.5, 'rate': 100.0, 'native': True}
+        })
+        self.kc.control_channel.send(debug_request)
+        debug_reply = self.kc.control_channel.get_msg(timeout=TIMEOUT)
+        self.assertTrue(debug_reply['content']['success'])
+
+        self.kc.input('sampled')
+        reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+        while reply['parent_header']['msg_id'] != msg_id:
+            reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+        self.assertEqual(reply['content']['status'], 'ok')
+
+    def test_xeus_python_execution_timings(self):
+        reply, output_msgs = self.execute_helper(code="print('timed')")
+        timings = reply['content']['xeus_python']['timings']
+        for phase in ('gil_wait', 'transform', 'parse', 'compile', 'run', 'publish', 'payload'):
+            self.assertGreaterEqual(timings[phase], 0)
+
+        # The running cell reads the timings of the previous one
+        reply, output_msgs = self.execute_helper(
+            code="print(sorted(get_ipython().kernel.execution_timings()) == {!r})".format(sorted(timings))
+        )
+        self.assertEqual(output_msgs[0]['content']['text'], 'True')
+
+    def test_xeus_python_memory_tracking(self):
+        reply, output_msgs = self.execute_helper(code="print('untracked')")
+        self.assertNotIn('memory', reply['content']['xeus_python'])
+
+        self.execute_helper(code="get_ipython().kernel.enable_memory_tracking(tracemalloc=True, top=5)")
+        try:
+            reply, output_msgs = self.execute_helper(code="memory_block = bytearray(16 * 1024 * 1024)")
+            memory = reply['content']['xeus_python']['memory']
+            self.assertEqual(memory['execution_count'], reply['content']['execution_count'])
+            self.assertIn('allocated_blocks', memory)
+            if sys.platform.startswith('linux'):
+                self.assertGreaterEqual(memory['rss']['after'], memory['rss']['before'])
+            self.assertGreaterEqual(memory['traced']['delta'], 16 * 1024 * 1024)
+            self.assertLessEqual(len(memory['top_allocations']), 5)
+            self.assertGreaterEqual(memory['top_allocations'][0]['size_diff'], 16 * 1024 * 1024)
+
+            reply, output_msgs = self.execute_helper(
+                code="print(get_ipython().kernel.memory_history()[-1]['traced']['delta'] > 0)"
+            )
+            self.assertEqual(output_msgs[0]['content']['text'], 'True')
+        finally:
+            self.execute_helper(code="del memory_block; get_ipython().kernel.disable_memory_tracking()")
+
+    def test_xeus_python_timeit(self):
+        self.flush_channels()
+        self.execute_helper(code="timed_data = list(range(100))")
+        code = "timed = get_ipython().kernel.timeit('sum(timed_data)', number=100, repeat=5)"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(output_msgs[0]['msg_type'], 'display_data')
+        data = output_msgs[0]['content']['data']
+        self.assertIn('per loop (mean ± std. dev. of 5 runs, 100 loops each)', data['text/plain'])
+        self.assertIn('text/html', data)
+        result = data['application/vnd.xpython.timeit+json']
+        self.assertEqual(len(result['timings']), 5)
+        self.assertLessEqual(result['min'], result['percentiles']['50'])
+        self.assertLessEqual(result['percentiles']['50'], result['max'])
+
+    def test_xeus_python_symbol_index_completion(self):
+        self.flush_channels()
+        self.execute_helper(code="import os\nindexed_name = 1")
+
+        self.kc.complete("indexed_na")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(reply['content']['matches'], ['indexed_name'])
+        self.assertEqual(reply['content']['cursor_start'], 0)
+
+        self.kc.complete("x = os.pa")
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('path', reply['content']['matches'])
+        self.assertEqual(reply['content']['cursor_start'], 7)
+
+        self.kc.complete("x = 1\nindexed_na")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(reply['content']['matches'], ['indexed_name'])
+        self.assertEqual(reply['content']['cursor_start'], 6)
+
+        # The keyword arguments of a call are only known to the completer
+        self.kc.complete("print(se")
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('sep=', reply['content']['matches'])
+
+    def test_xeus_python_inspect_cache(self):
+        self.flush_channels()
+        self.execute_helper(code="def inspected():\n    'first docstring'")
+        self.kc.inspect("inspected", 9)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('first docstring', reply['content']['data']['text/plain'])
+
+        self.execute_helper(code="def inspected():\n    'second docstring'")
+        self.kc.inspect("inspected", 9)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('second docstring', reply['content']['data']['text/plain'])
+
+    def test_xeus_python_inspect_cache_hit(self):
+        self.flush_channels()
+        self.execute_helper(code="""
+doc_reads = [0]
+class Documented:
+    @property
+    def __doc__(self):
+        doc_reads[0] += 1
+        return 'counted docstring'
+documented = Documented()
+""")
+        self.kc.inspect("documented", 10)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('counted docstring', reply['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code="print(doc_reads[0])\ndoc_reads[0] = 0")
+        first_reads = int(output_msgs[0]['content']['text'])
+        self.assertGreater(first_reads, 0)
+
+        # Executing the previous cell invalidated the cache, only the first
+        # of these requests reads the docstring.
+        for _ in range(2):
+            self.kc.inspect("documented", 10)
+            reply = self.get_non_kernel_info_reply()
+            self.assertIn('counted docstring', reply['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code="print(doc_reads[0])")
+        self.assertEqual(int(output_msgs[0]['content']['text']), first_reads)
+
+    def test_xeus_python_raw_comm_target(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="""
+import json
+from comm import get_comm_manager
+received = []
+def on_open(comm, content, buffers):
+    received.append(json.loads(content)['data']['value'])
+get_comm_manager().register_target('raw_target', on_open, raw=True)
+""")
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        msg = self.kc.session.msg('comm_open', {
+            'comm_id': 'raw-comm',
+            'target_name': 'raw_target',
+            'data': {'value': 42}
+        })
+        self.kc.shell_channel.send(msg)
+
+        reply, output_msgs = self.execute_helper(code='print(received)')
+        self.assertEqual(output_msgs[0]['content']['text'], '[42]')
+
+    def test_xeus_python_raw_comm_kept_buffers(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="""
+from comm import get_comm_manager
+kept = []
+def on_open(comm, content, buffers):
+    kept.append(buffers[0][2:])
+get_comm_manager().register_target('raw_kept_target', on_open, raw=True)
+""")
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        # The views kept by the handler must outlive the messages
+        for i in range(8):
+            msg = self.kc.session.msg('comm_open', {
+                'comm_id': 'raw-kept-comm-%d' % i,
+                'target_name': 'raw_kept_target',
+                'data': {}
+            })
+            self.kc.session.send(self.kc.shell_channel.socket, msg, buffers=[bytes([i]) * 64])
+
+        reply, output_msgs = self.execute_helper(
+            code="print(all(bytes(view) == bytes([i]) * 62 for i, view in enumerate(kept)), len(kept))"
+        )
+        self.assertEqual(output_msgs[0]['content']['text'].strip(), 'True 8')
+
+    def test_xeus_python_batch_execution(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="pass")
+        execution_count = reply['content']['execution_count']
+
+        msg = self.kc.session.msg('comm_open', {
+            'comm_id': 'batch-comm',
+            'target_name': 'xeus-python.batch',
+            'data': {'cells': ['batch_x = 1', "print(batch_x + 1, end='')", 'batch_x * 42', '1 / 0', 'print(3)']}
+        })
+        self.kc.shell_channel.send(msg)
+
+        events = []
+        while True:
+            out = self.kc.get_iopub_msg(timeout=TIMEOUT)
+            if out['parent_header'].get('msg_id') != msg['header']['msg_id']:
+                continue
+            if out['msg_type'] == 'stream':
+                events.append(('stream', out['content']['text']))
+            elif out['msg_type'] == 'execute_result':
+                content = out['content']
+                events.append((
+                    'execute_result',
+                    content['execution_count'],
+                    content['metadata']['xeus_python']['batch_index'],
+                    content['data']['text/plain']
+                ))
+            elif out['msg_type'] in ('comm_msg', 'comm_close'):
+                data = out['content']['data']
+                events.append((data['event'], data.get('index'), data.get('status')))
+                if out['msg_type'] == 'comm_close':
+                    break
+
+        self.assertEqual(events, [
+            ('cell_start', 0, None), ('cell_end', 0, 'ok'),
+            ('cell_start', 1, None), ('stream', '2'), ('cell_end', 1, 'ok'),
+            ('cell_start', 2, None), ('execute_result', execution_count + 1, 2, '42'), ('cell_end', 2, 'ok'),
+            ('cell_start', 3, None), ('cell_end', 3, 'error'),
+            ('batch_end', None, 'error'),
+        ])
+
+    def test_xeus_python_comm_send_stream(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="""
+from comm import create_comm
+stream_comm = create_comm(target_name='stream_target')
+stream_id = stream_comm.send_stream(b'0123456789', chunk_size=4, window=2)
+""")
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        comm_msgs = [msg for msg in output_msgs if msg['msg_type'] == 'comm_msg']
+        self.assertEqual(len(comm_msgs), 3)
+        start = comm_msgs[0]['content']['data']
+        self.assertEqual(start['method'], 'stream_start')
+        self.assertEqual(start['chunks'], 3)
+        self.assertEqual(start['size'], 10)
+        self.assertEqual([msg['content']['data']['seq'] for msg in comm_msgs[1:]], [0, 1])
+
+        ack = self.kc.session.msg('comm_msg', {
+            'comm_id': comm_msgs[0]['content']['comm_id'],
+            'data': {'method': 'stream_ack', 'stream_id': start['stream_id'], 'seq': 1}
+        })
+        self.kc.shell_channel.send(ack)
+
+        while True:
+            msg = self.kc.get_iopub_msg(timeout=10)
+            if msg['msg_type'] == 'comm_msg':
+                break
+        self.assertEqual(msg['content']['data']['seq'], 2)
+        self.assertEqual(msg['content']['data']['offset'], 8)
+        self.assertEqual(len(msg['buffers']), 1)
+
+    def test_xeus_python_comm_send_stream_strided(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="""
+from comm import create_comm
+strided_comm = create_comm(target_name='strided_target')
+strided_comm.send_stream(memoryview(b'0123456789')[::2], chunk_size=4, window=1)
+""")
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        comm_msgs = [msg for msg in output_msgs if msg['msg_type'] == 'comm_msg']
+        self.assertEqual(comm_msgs[0]['content']['data']['size'], 5)
+        self.assertEqual(bytes(comm_msgs[1]['buffers'][0]), b'0246')
+
+        close = self.kc.session.msg('comm_close', {
+            'comm_id': comm_msgs[0]['content']['comm_id'],
+            'data': {}
+        })
+        self.kc.shell_channel.send(close)
+
+        reply, output_msgs = self.execute_helper(code="print(strided_comm.pending_streams)")
+        self.assertEqual(output_msgs[0]['content']['text'], '0')
+
+    @unittest.skipIf(sys.platform.startswith('win'), 'POSIX shared memory is not available on Windows')
+    def test_xeus_python_comm_shared_memory(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="""
+from comm import create_comm, read_shared_memory
+shm_comm = create_comm(target_name='shm_target')
+shm_comm.enable_shared_memory(threshold=16)
+shm_comm.send(data={'value': 1}, buffers=[b'small', b'x' * 64])
+""")
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        comm_msg = [msg for msg in output_msgs if msg['msg_type'] == 'comm_msg'][0]
+        handles = comm_msg['metadata']['shm_buffers']
+        self.assertEqual(len(handles), 1)
+        self.assertEqual(handles[0]['index'], 1)
+        self.assertEqual(handles[0]['size'], 64)
+        self.assertEqual(len(comm_msg['buffers']), 2)
+
+        reply, output_msgs = self.execute_helper(
+            code="print(read_shared_memory('{}', 64) == b'x' * 64)".format(handles[0]['name'])
+        )
+        self.assertEqual(output_msgs[0]['content']['text'], 'True')
+
+        release = self.kc.session.msg('comm_msg', {
+            'comm_id': comm_msg['content']['comm_id'],
+            'data': {'method': 'shm_release', 'names': [42, None, handles[0]['name']]}
+        })
+        self.kc.shell_channel.send(release)
+
+        reply, output_msgs = self.execute_helper(
+            code="read_shared_memory('{}', 64)".format(handles[0]['name'])
+        )
+        self.assertEqual(reply['content']['status'], 'error')
+
+
+@unittest.skipIf(sys.platform.startswith('win'), 'The completion worker requires POSIX pipes')
+class XeusPythonCompletionWorkerTests(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        env = dict(os.environ, XPYTHON_COMPLETION_WORKER='1')
+        cls.km, cls.kc = start_new_kernel(
+            kernel_name='xpython',
+            extra_arguments=['--concurrent-comms'],
+            env=env
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.kc.stop_channels()
+        cls.km.shutdown_kernel()
+
+    def test_xeus_python_complete_while_busy(self):
+        self.kc.execute_interactive("worker_variable = 1", timeout=TIMEOUT)
+
+        execute_id = self.kc.execute(
+            "import time\nend = time.time() + 5\nwhile time.time() < end: pass"
+        )
+        complete_id = self.kc.complete("worker_var")
+
+        # The complete request must be answered while the cell is running
+        replies = []
+        while execute_id not in [msg['parent_header']['msg_id'] for msg in replies]:
+            replies.append(self.kc.get_shell_msg(timeout=TIMEOUT))
+        self.assertEqual(replies[0]['parent_header']['msg_id'], complete_id)
+
+        complete_reply = replies[0]['content']
+        self.assertEqual(complete_reply['status'], 'ok')
+        self.assertIn('worker_variable', complete_reply['matches'])
+
+
+class XeusPythonConcurrentRequestsTests(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.km, cls.kc = start_new_kernel(
+            kernel_name='xpython',
+            extra_arguments=['--concurrent-comms']
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.kc.stop_channels()
+        cls.km.shutdown_kernel()
+
+    def control_request(self, msg_type, content):
+        msg = self.kc.session.msg(msg_type, content)
+        self.kc.control_channel.send(msg)
+        reply = self.kc.control_channel.get_msg(timeout=TIMEOUT)
+        self.assertEqual(reply['parent_header']['msg_id'], msg['header']['msg_id'])
+        return reply['content']
+
+    def test_xeus_python_lightweight_requests_while_busy(self):
+        self.kc.execute_interactive("concurrent_variable = 1", timeout=TIMEOUT)
+
+        execute_id = self.kc.execute(
+            "import time\nend = time.time() + 5\nwhile time.time() < end: pass"
+        )
+        info_id = self.kc.kernel_info()
+        complete_id = self.kc.complete("concurrent_var")
+
+        # Both requests must be answered while the cell is running
+        replies = []
+        while execute_id not in [msg['parent_header']['msg_id'] for msg in replies]:
+            replies.append(self.kc.get_shell_msg(timeout=TIMEOUT))
+        replies = {msg['parent_header']['msg_id']: msg for msg in replies[:2]}
+        self.assertEqual(set(replies), {info_id, complete_id})
+        self.assertIn('concurrent_variable', replies[complete_id]['content']['matches'])
+
+    def test_xeus_python_lightweight_requests_while_sleeping(self):
+        self.kc.execute_interactive("concurrent_history = 1", timeout=TIMEOUT)
+
+        # No bytecode runs while the cell sleeps, the requests are answered
+        # without the main thread.
+        execute_id = self.kc.execute("import time\ntime.sleep(5)")
+        request_ids = {
+            self.kc.kernel_info(): 'kernel_info_reply',
+            self.kc.history(hist_access_type='tail', n=1): 'history_reply',
+            self.kc.is_complete("for i in range(3):"): 'is_complete_reply',
+        }
+
+        replies = []
+        while execute_id not in [msg['parent_header']['msg_id'] for msg in replies]:
+            replies.append(self.kc.get_shell_msg(timeout=TIMEOUT))
+        self.assertEqual(
+            {msg['parent_header']['msg_id']: msg['msg_type'] for msg in replies[:3]},
+            request_ids
+        )
+        self.assertEqual(replies[3]['parent_header']['msg_id'], execute_id)
+
+    def test_xeus_python_multiline_completion_while_busy(self):
+        self.kc.execute_interactive("multiline_variable = 1", timeout=TIMEOUT)
+
+        # Only the symbol index answers while a cell is running
+        execute_id = self.kc.execute(
+            "import time\nend = time.time() + 5\nwhile time.time() < end: pass"
+        )
+        complete_id = self.kc.complete("x = 1\nmultiline_var")
+
+        replies = []
+        while execute_id not in [msg['parent_header']['msg_id'] for msg in replies]:
+            replies.append(self.kc.get_shell_msg(timeout=TIMEOUT))
+        self.assertEqual(replies[0]['parent_header']['msg_id'], complete_id)
+        self.assertEqual(replies[0]['content']['matches'], ['multiline_variable'])
+
+    def test_xeus_python_comm_msg_while_busy(self):
+        self.kc.execute_interactive("""
+import time
+from comm import get_comm_manager
+events = []
+def on_open(comm, msg):
+    comm.on_msg(lambda msg: events.append(msg['content']['data']['value']))
+get_comm_manager().register_target('concurrent_target', on_open)
+""", timeout=TIMEOUT)
+        self.kc.shell_channel.send(self.kc.session.msg('comm_open', {
+            'comm_id': 'concurrent-comm',
+            'target_name': 'concurrent_target',
+            'data': {}
+        }))
+
+        # The cell only completes early if the comm message is dispatched
+        # while it runs. The execute requests are deferred in order.
+        execute_id = self.kc.execute(
+            "end = time.time() + 10\nwhile not events and time.time() < end: pass\nevents.append('cell')"
+        )
+        first_id = self.kc.execute("events.append('first')")
+        self.kc.shell_channel.send(self.kc.session.msg('comm_msg', {
+            'comm_id': 'concurrent-comm',
+            'data': {'value': 'comm'}
+        }))
+        second_id = self.kc.execute("events.append('second')")
+
+        reply_ids = []
+        while second_id not in reply_ids:
+            msg = self.kc.get_shell_msg(timeout=TIMEOUT)
+            if msg['msg_type'] == 'execute_reply':
+                reply_ids.append(msg['parent_header']['msg_id'])
+        self.assertEqual(reply_ids[-3:], [execute_id, first_id, second_id])
+
+        outputs = []
+        def output_hook(msg):
+            if msg['msg_type'] == 'stream':
+                outputs.append(msg['content']['text'])
+        self.kc.execute_interactive("print(events)", timeout=TIMEOUT, output_hook=output_hook)
+        self.assertEqual(''.join(outputs).strip(), "['comm', 'cell', 'first', 'second']")
+
+    @unittest.skipIf(sysconfig.get_config_var('Py_GIL_DISABLED'), 'Subshells require the GIL')
+    def test_xeus_python_subshells(self):
+        info_id = self.kc.kernel_info()
+        reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+        while reply['parent_header']['msg_id'] != info_id:
+            reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+        self.assertIn('kernel subshells', reply['content']['supported_features'])
+
+        subshell_id = self.control_request('create_subshell_request', {})['subshell_id']
+        self.assertEqual(self.control_request('list_subshell_request', {})['subshell_id'], [subshell_id])
+
+        # The cell of the main shell only prints True if the request of the
+        # subshell runs while it is waiting.
+        self.kc.execute_interactive("import threading\nsubshell_event = threading.Event()", timeout=TIMEOUT)
+        execute_id = self.kc.execute("print(subshell_event.wait(10))")
+        msg = self.kc.session.msg('execute_request', {
+            'code': "subshell_event.set()\nprint('subshell')",
+            'silent': False,
+            'store_history': False,
+            'user_expressions': {},
+            'allow_stdin': False,
+            'stop_on_error': True
+        })
+        msg['header']['subshell_id'] = subshell_id
+        self.kc.shell_channel.send(msg)
+        subshell_msg_id = msg['header']['msg_id']
+
+        outputs = {execute_id: '', subshell_msg_id: ''}
+        pending = set(outputs)
+        while pending:
+            out = self.kc.get_iopub_msg(timeout=TIMEOUT)
+            parent_id = out['parent_header'].get('msg_id')
+            if parent_id not in outputs:
+                continue
+            if out['msg_type'] == 'stream':
+                outputs[parent_id] += out['content']['text']
+            elif out['msg_type'] == 'status' and out['content']['execution_state'] == 'idle':
+                pending.discard(parent_id)
+        self.assertEqual(outputs[execute_id].strip(), 'True')
+        self.assertEqual(outputs[subshell_msg_id].strip(), 'subshell')
+
+        reply_ids = set()
+        while len(reply_ids) < 2:
+            reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+            if reply['msg_type'] == 'execute_reply':
+                reply_ids.add(reply['parent_header']['msg_id'])
+                self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(reply_ids, set(outputs))
+
+        content = self.control_request('delete_subshell_request', {'subshell_id': subshell_id})
+        self.assertEqual(content['status'], 'ok')
+        self.assertEqual(self.control_request('list_subshell_request', {})['subshell_id'], [])
+        content = self.control_request('delete_subshell_request', {'subshell_id': subshell_id})
+        self.assertEqual(content['status'], 'error')
+
+    @unittest.skipIf(sysconfig.get_config_var('Py_GIL_DISABLED'), 'Subshells require the GIL')
+    def test_xeus_python_delete_busy_subshell(self):
+        self.kc.execute_interactive("import threading\nsubshell_gate = threading.Event()", timeout=TIMEOUT)
+        subshell_id = self.control_request('create_subshell_request', {})['subshell_id']
+
+        # The second request is still queued when the subshell is deleted
+        msg_ids = []
+        for code in ["subshell_gate.wait(10)", "print('queued')"]:
+            msg = self.kc.session.msg('execute_request', {
+                'code': code,
+                'silent': False,
+                'store_history': False,
+                'user_expressions': {},
+                'allow_stdin': False,
+                'stop_on_error': True
+            })
+            msg['header']['subshell_id'] = subshell_id
+            self.kc.shell_channel.send(msg)
+            msg_ids.append(msg['header']['msg_id'])
+
+        while True:
+            out = self.kc.get_iopub_msg(timeout=TIMEOUT)
+            if out['parent_header'].get('msg_id') == msg_ids[0] and out['msg_type'] == 'execute_input':
+                break
+
+        content = self.control_request('delete_subshell_request', {'subshell_id': subshell_id})
+        self.assertEqual(content['status'], 'ok')
+        gate_id = self.kc.execute("subshell_gate.set()")
+
+        replies = {}
+        while len(replies) < 3:
+            reply = self.kc.get_shell_msg(timeout=TIMEOUT)
+            if reply['msg_type'] == 'execute_reply':
+                replies[reply['parent_header']['msg_id']] = reply['content']['status']
+        self.assertEqual(replies, {msg_ids[0]: 'ok', msg_ids[1]: 'ok', gate_id: 'ok'})
+
 
 if __name__ == '__main__':
     unittest.main()
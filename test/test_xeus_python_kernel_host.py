@@ -0,0 +1,116 @@
+#############################################################################
+# Copyright (c) 2018, Martin Renou, Johan Mabille, Sylvain Corlay, and      #
+# Wolf Vollprecht                                                           #
+# Copyright (c) 2018, QuantStack                                            #
+#                                                                           #
+# Distributed under the terms of the BSD 3-Clause License.                  #
+#                                                                           #
+# The full license is in the file LICENSE, distributed with this software.  #
+#############################################################################
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+from jupyter_client import BlockingKernelClient
+from jupyter_client.connect import write_connection_file
+
+TIMEOUT = 30
+
+
+@unittest.skipIf(sys.platform.startswith("win"), "The kernel host relies on FIFOs")
+@unittest.skipIf(shutil.which("xpython") is None, "xpython is not installed")
+class XeusPythonKernelHostTests(unittest.TestCase):
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.fifo = os.path.join(self.tmpdir, "kernel_host")
+        self.log = open(os.path.join(self.tmpdir, "kernel_host.log"), "w+")
+        self.host = subprocess.Popen(
+            ["xpython", "--kernel-host", self.fifo],
+            stdout=subprocess.DEVNULL, stderr=self.log
+        )
+
+        deadline = time.monotonic() + TIMEOUT
+        while not os.path.exists(self.fifo):
+            if self.host.poll() is not None:
+                # Only builds without subinterpreter support are skipped,
+                # any other early exit is a crash of the host.
+                self.log.seek(0)
+                log = self.log.read()
+                if "The kernel host requires a Python and a pybind11 with subinterpreter support" in log:
+                    self.skipTest("The kernel host is not supported by this build")
+                self.fail("The kernel host exited with status %d:\n%s" % (self.host.returncode, log))
+            if time.monotonic() > deadline:
+                self.fail("The kernel host did not create its FIFO")
+            time.sleep(0.1)
+
+        self.clients = []
+
+    def tearDown(self):
+        for client in self.clients:
+            client.stop_channels()
+        if self.host.poll() is None:
+            self.host.kill()
+            self.host.wait()
+        self.log.close()
+        shutil.rmtree(self.tmpdir, ignore_errors=True)
+
+    def start_kernel(self, name):
+        connection_file, _ = write_connection_file(os.path.join(self.tmpdir, name + ".json"))
+        with open(self.fifo, "w") as fifo:
+            fifo.write(connection_file + "\n")
+
+        client = BlockingKernelClient(connection_file=connection_file)
+        client.load_connection_file()
+        client.start_channels()
+        client.wait_for_ready(timeout=TIMEOUT)
+        self.clients.append(client)
+        return client
+
+    def execute(self, client, code):
+        outputs = []
+        reply = client.execute_interactive(
+            code, timeout=TIMEOUT,
+            output_hook=lambda msg: outputs.append(msg)
+        )
+        return reply, outputs
+
+    def test_xeus_python_kernel_host_namespaces(self):
+        first = self.start_kernel("first")
+        second = self.start_kernel("second")
+
+        reply, _ = self.execute(first, "x = 1")
+        self.assertEqual(reply["content"]["status"], "ok")
+
+        reply, _ = self.execute(second, "x")
+        self.assertEqual(reply["content"]["status"], "error")
+        self.assertEqual(reply["content"]["ename"], "NameError")
+
+        reply, outputs = self.execute(first, "print(x)")
+        self.assertEqual(reply["content"]["status"], "ok")
+        streams = [msg["content"]["text"] for msg in outputs if msg["msg_type"] == "stream"]
+        self.assertEqual("".join(streams), "1\n")
+
+    def test_xeus_python_kernel_host_warmup(self):
+        # The warm-up thread is started by the kernel_info request sent
+        # when the client connects.
+        client = self.start_kernel("warmup")
+        code = "import sys; print('jedi' in sys.modules, end='')"
+        deadline = time.monotonic() + TIMEOUT
+        while True:
+            reply, outputs = self.execute(client, code)
+            self.assertEqual(reply["content"]["status"], "ok")
+            streams = [msg["content"]["text"] for msg in outputs if msg["msg_type"] == "stream"]
+            if "".join(streams) == "True" or time.monotonic() > deadline:
+                break
+            time.sleep(0.1)
+        self.assertEqual("".join(streams), "True")
+
+
+if __name__ == "__main__":
+    unittest.main()
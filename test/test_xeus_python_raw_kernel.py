@@ -8,11 +8,14 @@
 # The full license is in the file LICENSE, distributed with this software.  #
 #############################################################################
 
+import os
 import unittest
 import jupyter_kernel_test
 
 from jupyter_client.manager import start_new_kernel
 
+TIMEOUT = 30
+
 
 class XeusPythonRawTests(jupyter_kernel_test.KernelTests):
 
@@ -27,6 +30,9 @@ class XeusPythonRawTests(jupyter_kernel_test.KernelTests):
         {'text': 'se', 'matches': {'set', 'setattr'}},
     ]
 
+    complete_code_samples = ['1', "print('hello, world')", "def f(x):\n  return x*2\n\n\n"]
+    incomplete_code_samples = ["print('''hello", "def f(x):\n  x*2"]
+
     code_inspect_sample = "open"
 
     @classmethod
@@ -57,6 +63,17 @@ class XeusPythonRawTests(jupyter_kernel_test.KernelTests):
                 'traceback']
         )
 
+    def test_xeus_python_thread_output(self):
+        self.flush_channels()
+        # Threads started by a cell have no request context
+        reply, output_msgs = self.execute_helper(
+            code="import threading\nt = threading.Thread(target=print, args=('x',))\nt.start()\nt.join()"
+        )
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        reply, output_msgs = self.execute_helper(code="print(2)")
+        self.assertEqual(output_msgs[0]['content']['text'], '2')
+
     def test_xeus_python_stderr(self):
         self.flush_channels()
         reply, output_msgs = self.execute_helper(code='a = []; a.push_back(3)')
@@ -74,6 +91,222 @@ class XeusPythonRawTests(jupyter_kernel_test.KernelTests):
             traceback[2]
         )
 
+    def test_xeus_python_execution_timings(self):
+        self.flush_channels()
+        reply, output_msgs = self.execute_helper(code="x = 1\nx")
+        timings = reply['content']['xeus_python']['timings']
+        for phase in ('gil_wait', 'parse', 'compile', 'run', 'publish'):
+            self.assertGreaterEqual(timings[phase], 0)
+
+        reply, output_msgs = self.execute_helper(
+            code="print(sorted(get_ipython().kernel.execution_timings()) == {!r})".format(sorted(timings))
+        )
+        self.assertEqual(output_msgs[0]['content']['text'], 'True')
+
+    def test_xeus_python_memory_tracking(self):
+        self.flush_channels()
+        self.execute_helper(code="get_ipython().kernel.enable_memory_tracking()")
+        try:
+            reply, output_msgs = self.execute_helper(code="tracked_list = [object() for _ in range(10000)]")
+            memory = reply['content']['xeus_python']['memory']
+            self.assertGreater(memory['allocated_blocks']['delta'], 0)
+            self.assertNotIn('top_allocations', memory)
+        finally:
+            self.execute_helper(code="del tracked_list; get_ipython().kernel.disable_memory_tracking()")
+
+    def test_xeus_python_timeit(self):
+        self.flush_channels()
+        code = "timed = get_ipython().kernel.timeit('x = sorted(y)', setup='y = [3, 1, 2] * 10', publish=False)\nprint(timed['loops'] > 0, timed['repeat'])"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(output_msgs[0]['content']['text'], 'True 7')
+
+        reply, output_msgs = self.execute_helper(code="print('x' in globals(), 'y' in globals())")
+        self.assertEqual(output_msgs[0]['content']['text'], 'False False')
+
+        reply, output_msgs = self.execute_helper(code="get_ipython().kernel.timeit('1 +')")
+        self.assertEqual(reply['content']['status'], 'error')
+        self.assertEqual(reply['content']['ename'], 'SyntaxError')
+
+    def test_xeus_python_code_cache(self):
+        self.flush_channels()
+        code = "cached_value = 21 * 2\ncached_value"
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        reply, output_msgs = self.execute_helper(code=code)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertNotIn('parse', reply['content']['xeus_python']['timings'])
+        self.assertEqual(output_msgs[0]['content']['data']['text/plain'], '42')
+
+    def test_xeus_python_completion_invalidation(self):
+        self.flush_channels()
+        self.execute_helper(code="completion_var_abc = 1")
+        self.kc.complete("completion_var_a")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(set(reply['content']['matches']), {'completion_var_abc'})
+
+        self.execute_helper(code="completion_var_abd = 2")
+        self.kc.complete("completion_var_a")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(set(reply['content']['matches']), {'completion_var_abc', 'completion_var_abd'})
+
+    def test_xeus_python_inspect_cache(self):
+        self.flush_channels()
+        self.execute_helper(code="def inspected():\n    'first docstring'")
+        self.kc.inspect("inspected", 9)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('first docstring', reply['content']['data']['text/plain'])
+
+        self.execute_helper(code="def inspected():\n    'second docstring'")
+        self.kc.inspect("inspected", 9)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('second docstring', reply['content']['data']['text/plain'])
+
+    def test_xeus_python_inspect_cache_hit(self):
+        self.flush_channels()
+        self.execute_helper(code="""
+doc_reads = [0]
+class Documented:
+    @property
+    def __doc__(self):
+        doc_reads[0] += 1
+        return 'counted docstring'
+documented = Documented()
+""")
+        self.kc.inspect("documented", 10)
+        reply = self.get_non_kernel_info_reply()
+        self.assertIn('counted docstring', reply['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code="print(doc_reads[0])\ndoc_reads[0] = 0")
+        first_reads = int(output_msgs[0]['content']['text'])
+        self.assertGreater(first_reads, 0)
+
+        # Executing the previous cell invalidated the cache, only the first
+        # of these requests reads the docstring.
+        for _ in range(2):
+            self.kc.inspect("documented", 10)
+            reply = self.get_non_kernel_info_reply()
+            self.assertIn('counted docstring', reply['content']['data']['text/plain'])
+        reply, output_msgs = self.execute_helper(code="print(doc_reads[0])")
+        self.assertEqual(int(output_msgs[0]['content']['text']), first_reads)
+
+    def test_xeus_python_batch_execution(self):
+        self.flush_channels()
+        code = "raw_batch_cells = globals().get('raw_batch_cells', []) + [lambda: 1 / 0]"
+        reply, output_msgs = self.execute_helper(code=code)
+        execution_count = reply['content']['execution_count']
+
+        # The batch runs the same code as the previous execute request
+        msg = self.kc.session.msg('comm_open', {
+            'comm_id': 'raw-batch-comm',
+            'target_name': 'xeus-python.batch',
+            'data': {'cells': [code, '42']}
+        })
+        self.kc.shell_channel.send(msg)
+
+        results = []
+        while True:
+            out = self.kc.get_iopub_msg(timeout=TIMEOUT)
+            if out['parent_header'].get('msg_id') != msg['header']['msg_id']:
+                continue
+            if out['msg_type'] == 'execute_result':
+                results.append((
+                    out['content']['execution_count'],
+                    out['content']['metadata']['xeus_python']['batch_index'],
+                    out['content']['data']['text/plain']
+                ))
+            elif out['msg_type'] == 'comm_close':
+                break
+        # Batch results get the count of the next execute request, as in IPython
+        self.assertEqual(results, [(execution_count + 1, 1, '42')])
+
+        reply, output_msgs = self.execute_helper(code="first, second = raw_batch_cells\nfirst()")
+        self.assertEqual(reply['content']['execution_count'], execution_count + 1)
+        self.assertIn('[%d]' % execution_count, '\n'.join(reply['content']['traceback']))
+
+        reply, output_msgs = self.execute_helper(code="second()")
+        self.assertIn('[%d]' % (execution_count + 1), '\n'.join(reply['content']['traceback']))
+
+    def test_xeus_python_is_complete_indent(self):
+        self.flush_channels()
+        self.kc.is_complete("for i in range(3):  # loop")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(reply['content']['status'], 'incomplete')
+        self.assertEqual(reply['content']['indent'], '    ')
+
+        self.kc.is_complete("x = [1,\n     2")
+        reply = self.get_non_kernel_info_reply()
+        self.assertEqual(reply['content']['status'], 'incomplete')
+        self.assertEqual(reply['content']['indent'], '     ')
+
+    def test_xeus_python_profile_next_cell(self):
+        self.flush_channels()
+        self.execute_helper(code="from IPython.core.display import profile_next_cell\nprofile_next_cell(sort='ncalls', limit=5)")
+        reply, output_msgs = self.execute_helper(
+            code="def profiled(n):\n    return n if n < 2 else profiled(n - 1) + profiled(n - 2)\nprofiled(10)"
+        )
+        self.assertEqual(reply['content']['status'], 'ok')
+
+        displays = [msg for msg in output_msgs if msg['msg_type'] == 'display_data']
+        self.assertEqual(len(displays), 1)
+        data = displays[0]['content']['data']
+        self.assertIn('Ordered by: ncalls', data['text/plain'])
+        self.assertIn('<table>', data['text/html'])
+
+        profile = data['application/vnd.xpython.profile+json']
+        self.assertEqual(profile['functions'][0]['function'], 'profiled')
+        self.assertEqual(profile['functions'][0]['ncalls'], 177)
+        self.assertIn('(profiled)', profile['collapsed_stacks'])
+
+        # Only the next cell is profiled
+        reply, output_msgs = self.execute_helper(code="profiled(5)")
+        self.assertFalse([msg for msg in output_msgs if msg['msg_type'] == 'display_data'])
+
+
+class XeusPythonRawCompletionDeadlineTests(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        env = dict(os.environ, XPYTHON_COMPLETION_DEADLINE='500')
+        cls.km, cls.kc = start_new_kernel(
+            kernel_name='xpython',
+            extra_arguments=['--raw'],
+            env=env
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.kc.stop_channels()
+        cls.km.shutdown_kernel()
+
+    def test_xeus_python_completion_deadline(self):
+        self.kc.execute_interactive("""
+import time
+deadline_variable = 1
+def tick():
+    time.sleep(0.001)
+class SlowObject:
+    def __dir__(self):
+        # Calls Python functions for the deadline to be checked
+        end = time.monotonic() + 10
+        while time.monotonic() < end:
+            tick()
+        return ['attribute']
+slow_object = SlowObject()
+""", timeout=30)
+
+        self.kc.complete("deadline_variable.bit_len")
+        reply = self.kc.get_shell_msg(timeout=30)
+        self.assertEqual(reply['content']['matches'], ['bit_length'])
+        self.assertEqual(reply['content']['metadata'], {})
+
+        # Listing the attributes of the object takes 20 times the deadline
+        self.kc.complete("slow_object.attr")
+        reply = self.kc.get_shell_msg(timeout=30)
+        self.assertEqual(reply['content']['status'], 'ok')
+        self.assertEqual(reply['content']['matches'], [])
+        self.assertEqual(reply['content']['metadata'], {'partial': True})
+
 
 if __name__ == '__main__':
     unittest.main()